@@ -1,11 +1,28 @@
 #include "analyzer.h"
+#include "csv_scan.h"
+#include "fixed_decimal.h"
+#include "hyperloglog.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cctype>
+#include <cmath>
+#include <cstring>
 #include <fstream>
+#include <iterator>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TRIP_HAVE_MMAP 1
+#endif
+
 using namespace std;
 
 namespace {
@@ -14,37 +31,40 @@ static inline bool is_space(unsigned char c) { return std::isspace(c) != 0; }
 static inline bool is_digit(unsigned char c) { return std::isdigit(c) != 0; }
 
 // Trim range [b,e) over a string without allocating
-static inline void trim_range(const string& s, size_t& b, size_t& e) {
+static inline void trim_range(string_view s, size_t& b, size_t& e) {
     while (b < e && is_space((unsigned char)s[b])) ++b;
     while (e > b && is_space((unsigned char)s[e - 1])) --e;
 }
 
+// Outcome of parsing a pickup time; the failures map onto IngestStats reasons.
+enum class TimeStatus { Ok, BadTime, BadHour, BadMinute };
+
 // Parse hour from a datetime-like field such as "YYYY-MM-DD HH:MM".
-static bool parse_hour_from_datetime(const string& s, size_t b, size_t e, int& hour_out) {
+static TimeStatus parse_hour_from_datetime(string_view s, size_t b, size_t e, int& hour_out) {
     trim_range(s, b, e);
-    if (b >= e) return false;
+    if (b >= e) return TimeStatus::BadTime;
 
     // Find space between date and time.
     size_t sp = s.find(' ', b);
-    if (sp == string::npos || sp >= e) return false;
+    if (sp == string_view::npos || sp >= e) return TimeStatus::BadTime;
 
     // Find ':' after the space.
     size_t colon = s.find(':', sp + 1);
-    if (colon == string::npos || colon >= e) return false;
+    if (colon == string_view::npos || colon >= e) return TimeStatus::BadTime;
 
     // Minute: must have 2 digits after ':'
     size_t m0 = colon + 1;
-    if (m0 + 1 >= e) return false;
-    if (!is_digit((unsigned char)s[m0]) || !is_digit((unsigned char)s[m0 + 1])) return false;
+    if (m0 + 1 >= e) return TimeStatus::BadMinute;
+    if (!is_digit((unsigned char)s[m0]) || !is_digit((unsigned char)s[m0 + 1])) return TimeStatus::BadMinute;
 
     int minute = (s[m0] - '0') * 10 + (s[m0 + 1] - '0');
-    if (minute < 0 || minute > 59) return false;
+    if (minute < 0 || minute > 59) return TimeStatus::BadMinute;
 
     // Hour: 1-2 digits before ':' ignoring spaces
-    if (colon == 0) return false;
+    if (colon == 0) return TimeStatus::BadTime;
     size_t i = colon - 1;
     while (i > b && is_space((unsigned char)s[i])) --i;
-    if (!is_digit((unsigned char)s[i])) return false;
+    if (!is_digit((unsigned char)s[i])) return TimeStatus::BadHour;
 
     int hour = s[i] - '0';
 
@@ -57,175 +77,1195 @@ static bool parse_hour_from_datetime(const string& s, size_t b, size_t e, int& h
         }
     }
 
-    if (hour < 0 || hour > 23) return false;
+    if (hour < 0 || hour > 23) return TimeStatus::BadHour;
+    hour_out = hour;
+    return TimeStatus::Ok;
+}
+
+// Fast path for the canonical 16-byte "YYYY-MM-DD HH:MM" layout: two 8-byte
+// loads, one compare for the separators and a SWAR digit test for the rest.
+// Returns false whenever the layout does not match exactly, including valid
+// but non-canonical spellings, so the caller can fall back to the tolerant
+// parser above. Accepts exactly the inputs that parser maps to the same hour.
+static inline bool parse_hour_canonical(string_view s, size_t b, size_t e, int& hour_out) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (e - b != 16) return false;
+    uint64_t w0, w1;
+    memcpy(&w0, s.data() + b, 8);      // "YYYY-MM-"
+    memcpy(&w1, s.data() + b + 8, 8);  // "DD HH:MM"
+
+    // Separator bytes: '-' at 4 and 7, ' ' at 10 (w1 byte 2), ':' at 13 (w1 byte 5).
+    constexpr uint64_t kSep0 = 0xFF0000FF00000000ull;
+    constexpr uint64_t kSep1 = 0x0000FF0000FF0000ull;
+    constexpr uint64_t kSepVal0 = 0x2D00002D00000000ull;
+    constexpr uint64_t kSepVal1 = 0x00003A0000200000ull;
+    if ((w0 & kSep0) != kSepVal0 || (w1 & kSep1) != kSepVal1) return false;
+
+    // Every other byte must be '0'..'9': high nibble 3, and still 3 after +6.
+    constexpr uint64_t kHi = 0xF0F0F0F0F0F0F0F0ull;
+    constexpr uint64_t kThrees = 0x3030303030303030ull;
+    constexpr uint64_t kSix = 0x0606060606060606ull;
+    uint64_t d0 = (w0 & ~kSep0) | (kThrees & kSep0);
+    uint64_t d1 = (w1 & ~kSep1) | (kThrees & kSep1);
+    if ((d0 & kHi) != kThrees || ((d0 + kSix) & kHi) != kThrees) return false;
+    if ((d1 & kHi) != kThrees || ((d1 + kSix) & kHi) != kThrees) return false;
+
+    int hour = (s[b + 11] - '0') * 10 + (s[b + 12] - '0');
+    int minute = (s[b + 14] - '0') * 10 + (s[b + 15] - '0');
+    if (hour > 23 || minute > 59) return false;
     hour_out = hour;
     return true;
+#else
+    (void)s; (void)b; (void)e; (void)hour_out;
+    return false;
+#endif
 }
 
-static inline bool better_zone(const ZoneCount& a, const ZoneCount& b) {
-    if (a.count != b.count) return a.count > b.count; // count desc
-    return a.zone < b.zone;                           // zone asc
+// Candidates during top-K selection: a count plus the zone id (or slot id =
+// zone id * 24 + hour). Names are only looked up to break ties, as views into
+// the dictionary, so ranking allocates nothing per candidate.
+struct ZoneRank {
+    long long count;
+    uint32_t id;
+};
+
+struct SlotRank {
+    long long count;
+    uint32_t slot;
+};
+
+struct BucketRank {
+    long long count;
+    uint32_t id;
+    int32_t bucket;
+};
+
+struct RouteRank {
+    long long count;
+    uint32_t pickup;
+    uint32_t dropoff;
+};
+
+// A zone's sum and row count of one measure; ranked by the sum, or by the
+// exact ratio sum / rows for averages.
+struct MeasureRank {
+    long long sum;
+    long long rows;
+    uint32_t id;
+};
+
+static inline bool better_zone(const ZoneDictionary& zones, const ZoneRank& a, const ZoneRank& b) {
+    if (a.count != b.count) return a.count > b.count;   // count desc
+    return zones.name(a.id) < zones.name(b.id);          // zone asc
+}
+
+static inline bool better_slot(const ZoneDictionary& zones, const SlotRank& a, const SlotRank& b) {
+    if (a.count != b.count) return a.count > b.count;   // count desc
+    uint32_t za = a.slot / 24, zb = b.slot / 24;
+    if (za != zb) return zones.name(za) < zones.name(zb);   // zone asc
+    return a.slot % 24 < b.slot % 24;                        // hour asc
 }
 
-static inline bool better_slot(const SlotCount& a, const SlotCount& b) {
-    if (a.count != b.count) return a.count > b.count; // count desc
-    if (a.zone != b.zone)   return a.zone < b.zone;   // zone asc
-    return a.hour < b.hour;                           // hour asc
+static inline bool better_bucket(const ZoneDictionary& zones, const BucketRank& a, const BucketRank& b) {
+    if (a.count != b.count) return a.count > b.count;               // count desc
+    if (a.id != b.id) return zones.name(a.id) < zones.name(b.id);   // zone asc
+    return a.bucket < b.bucket;                                     // bucket asc
 }
 
-static bool field_range(const string& line, const vector<size_t>& commas, size_t idx, size_t& b, size_t& e) {
-    // Field idx in a comma-separated line: [commas[idx-1]+1, commas[idx])
-    if (idx == 0) {
-        b = 0;
-        e = commas.empty() ? line.size() : commas[0];
-        return true;
+static inline bool better_measure(const ZoneDictionary& zones, bool average, const MeasureRank& a,
+                                  const MeasureRank& b) {
+    if (average) {
+        // a.sum / a.rows vs b.sum / b.rows without rounding; rows > 0.
+#ifdef __SIZEOF_INT128__
+        __int128 l = (__int128)a.sum * b.rows, r = (__int128)b.sum * a.rows;
+#else
+        long double l = (long double)a.sum * b.rows, r = (long double)b.sum * a.rows;
+#endif
+        if (l != r) return l > r;                     // average desc
+    } else if (a.sum != b.sum) {
+        return a.sum > b.sum;                         // sum desc
     }
-    if (idx - 1 >= commas.size()) return false; // no such field
+    return zones.name(a.id) < zones.name(b.id);       // zone asc
+}
 
-    b = commas[idx - 1] + 1;
-    e = (idx < commas.size()) ? commas[idx] : line.size();
-    if (b > line.size()) return false;
-    if (e > line.size()) e = line.size();
-    return true;
+static inline bool better_route(const ZoneDictionary& zones, const RouteRank& a, const RouteRank& b) {
+    if (a.count != b.count) return a.count > b.count;                               // count desc
+    if (a.pickup != b.pickup) return zones.name(a.pickup) < zones.name(b.pickup);   // pickup asc
+    return zones.name(a.dropoff) < zones.name(b.dropoff);                           // dropoff asc
+}
+
+// Keep the k best entries of v (unordered) under `better`.
+template <class T, class Better>
+static void keep_top(vector<T>& v, size_t k, Better better) {
+    if (v.size() <= k) return;
+    nth_element(v.begin(), v.begin() + (ptrdiff_t)k, v.end(), better);
+    v.resize(k);
 }
 
-static inline string make_slot_key(const string& zone, int hour) {
-    string key;
-    key.reserve(zone.size() + 1 + 2);
-    key.append(zone);
-    key.push_back('|');
-    key.append(to_string(hour));
-    return key;
+// Zones per selection shard below which splitting the scan across threads
+// costs more than it saves.
+static constexpr size_t kMinSelectZones = 1 << 16;
+
+// The k best entries under `better`, sorted, from zones [0, zones).
+// fill(begin, end, out) appends the candidate entries of zones [begin, end).
+// With more than one shard, each thread keeps the top k of its own range of
+// zones; since `better` is a strict total order, the top k of those
+// survivors is exactly the overall top k.
+template <class T, class Fill, class Better>
+static vector<T> select_top(size_t zones, size_t k, unsigned threads, const Fill& fill, Better better) {
+    size_t shards = min<size_t>(threads, zones / kMinSelectZones);
+    vector<T> out;
+    if (shards <= 1) {
+        fill(0, zones, out);
+    } else {
+        vector<vector<T>> parts(shards);
+        vector<thread> workers;
+        workers.reserve(shards - 1);
+        auto run = [&](size_t i) {
+            fill(zones * i / shards, zones * (i + 1) / shards, parts[i]);
+            keep_top(parts[i], k, better);
+        };
+        for (size_t i = 1; i < shards; ++i) workers.emplace_back(run, i);
+        run(0);
+        for (auto& w : workers) w.join();
+
+        out.reserve(shards * k);
+        for (auto& part : parts) {
+            for (auto& e : part) out.push_back(std::move(e));
+        }
+    }
+    keep_top(out, k, better);
+    sort(out.begin(), out.end(), better);
+    return out;
 }
 
-static bool parse_hour_field_candidate(const string& line, const vector<size_t>& commas, size_t fieldIdx, int& hour_out) {
+// `slow` is set when the hour came from the tolerant parser.
+static TimeStatus parse_hour_field_candidate(const csv::Row& row, size_t fieldIdx, int& hour_out, bool& slow) {
     size_t b = 0, e = 0;
-    if (!field_range(line, commas, fieldIdx, b, e)) return false;
-    trim_range(line, b, e);
-    if (b >= e) return false;
-    return parse_hour_from_datetime(line, b, e, hour_out);
+    if (!row.field(fieldIdx, b, e)) return TimeStatus::BadTime;
+    trim_range(row.line, b, e);
+    if (b >= e) return TimeStatus::BadTime;
+    if (parse_hour_canonical(row.line, b, e, hour_out)) return TimeStatus::Ok;
+    TimeStatus st = parse_hour_from_datetime(row.line, b, e, hour_out);
+    slow = st == TimeStatus::Ok;
+    return st;
 }
 
-static bool parse_key_zone_hour(const string& key, string& zone_out, int& hour_out) {
-    size_t bar = key.rfind('|');
-    if (bar == string::npos) return false;
+// Days from 1970-01-01 to a proleptic Gregorian date (month 1-12).
+static int64_t days_from_civil(int64_t y, int m, int d) {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const int64_t yoe = y - era * 400;
+    const int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
 
-    zone_out = key.substr(0, bar);
-    if (zone_out.empty()) return false;
+// Minute of the hour of a pickup time field starting at b that already
+// parsed, in any accepted layout.
+static int pickup_minute(string_view s, size_t b) {
+    size_t colon = s.find(':', s.find(' ', b) + 1);
+    return (s[colon + 1] - '0') * 10 + (s[colon + 2] - '0');
+}
 
-    // Parse hour (0..23) from the tail
-    int hour = 0;
-    size_t p = bar + 1;
-    if (p >= key.size()) return false;
+// Minutes since 1970-01-01 00:00 for a pickup time field starting at b that
+// already parsed to `hour` and `minute`. The date must be "Y-M-D" with up to
+// four digits per part; otherwise, or when out of int32 range,
+// TripColumns::kNoValue.
+static int32_t pack_pickup_time(string_view s, size_t b, int hour, int minute) {
+    size_t sp = s.find(' ', b);
 
-    // allow 1-2 digits only
-    int digits = 0;
-    while (p < key.size()) {
-        unsigned char c = (unsigned char)key[p];
-        if (!is_digit(c)) return false;
-        hour = hour * 10 + (key[p] - '0');
-        ++digits;
-        if (digits > 2) return false;
-        ++p;
+    int parts[3] = {0, 0, 0};
+    size_t p = b;
+    for (int i = 0; i < 3; ++i) {
+        size_t start = p;
+        while (p < sp && p - start < 4 && is_digit((unsigned char)s[p])) parts[i] = parts[i] * 10 + (s[p++] - '0');
+        if (p == start) return TripColumns::kNoValue;
+        if (i < 2) {
+            if (p >= sp || s[p] != '-') return TripColumns::kNoValue;
+            ++p;
+        }
     }
+    if (p != sp || parts[1] < 1 || parts[1] > 12 || parts[2] < 1 || parts[2] > 31) return TripColumns::kNoValue;
 
-    if (digits == 0 || hour < 0 || hour > 23) return false;
-    hour_out = hour;
-    return true;
+    int64_t m = days_from_civil(parts[0], parts[1], parts[2]) * 1440 + hour * 60 + minute;
+    if (m <= INT32_MIN || m > INT32_MAX) return TripColumns::kNoValue;
+    return (int32_t)m;
 }
 
-} // namespace
+// Field idx of a row as fixed-point hundredths, or TripColumns::kNoValue
+// when absent (idx < 0 included) or not a plain decimal.
+static int32_t measure_field(const csv::Row& row, int idx) {
+    size_t b = 0, e = 0;
+    int32_t v;
+    if (idx < 0 || !row.field((size_t)idx, b, e) || !parse_hundredths(row.line.substr(b, e - b), v)) {
+        return TripColumns::kNoValue;
+    }
+    return v;
+}
 
-void TripAnalyzer::ingestFile(const std::string& csvPath) {
-    zoneCounts.clear();
-    slotCounts.clear();
+// Field idx of a row, trimmed; empty when absent (idx < 0 included).
+static string_view field_view(const csv::Row& row, int idx) {
+    size_t b = 0, e = 0;
+    if (idx < 0 || !row.field((size_t)idx, b, e)) return {};
+    trim_range(row.line, b, e);
+    return row.line.substr(b, e - b);
+}
 
-    ifstream file(csvPath);
-    if (!file.is_open()) return;
+// A row after parsing: its zone (a view into the input) and hour, or the
+// reason it was rejected. The remaining fields are filled only when
+// ParseWants asks for them.
+struct ParsedRow {
+    enum Status : uint8_t { Accepted, MissingZone, BadTime, BadHour, BadMinute };
 
-    // Optional perf tweak (safe on all tests)
-    zoneCounts.max_load_factor(0.5f);
-    slotCounts.max_load_factor(0.5f);
+    string_view zone;
+    int hour = -1;
+    Status status = MissingZone;
+    bool slow = false;
 
-    string line;
-    while (getline(file, line)) {
-        if (line.empty()) continue;
+    string_view dropoff;
+    int minute = -1;
+    int32_t minutes = TripColumns::kNoValue;
+    int32_t distance = TripColumns::kNoValue;
+    int32_t fare = TripColumns::kNoValue;
+};
 
-        // Collect comma positions
-        vector<size_t> commas;
-        commas.reserve(8);
-        for (size_t i = 0; i < line.size(); ++i) {
-            if (line[i] == ',') commas.push_back(i);
-        }
+static ParsedRow::Status reject_reason(TimeStatus st) {
+    switch (st) {
+    case TimeStatus::BadHour: return ParsedRow::BadHour;
+    case TimeStatus::BadMinute: return ParsedRow::BadMinute;
+    default: return ParsedRow::BadTime;
+    }
+}
+
+// What parse_row fills in beyond zone and hour, from what the tables keep.
+struct ParseWants {
+    bool time = false;       // ParsedRow::minute and minutes
+    bool dropoff = false;
+    bool measures = false;   // distance and fare
+
+    // Heavy-hitter mode only counts pickups, whatever else is switched on.
+    explicit ParseWants(const TripTables& t)
+        : time(t.approxCounters == 0 && (t.keepRows || t.buckets.timed())),
+          dropoff(t.approxCounters == 0 && (t.keepRows || t.countRoutes)),
+          measures(t.approxCounters == 0 && (t.keepRows || t.keepMeasures || t.keepFareSketches)) {}
+
+    bool any() const { return time || dropoff || measures; }
+};
 
-        // Zone is field 1
-        size_t z_b = 0, z_e = 0;
-        if (!field_range(line, commas, 1, z_b, z_e)) continue;
-        trim_range(line, z_b, z_e);
-        if (z_b >= z_e) continue;
+// The wanted optional fields of an accepted row whose time was read from
+// field `timeColumn`.
+static void parse_wanted(const csv::Row& row, const CsvSchema& schema, int timeColumn, ParseWants wants,
+                         ParsedRow& out) {
+    if (wants.time) {
+        size_t b = 0, e = 0;
+        row.field((size_t)timeColumn, b, e);
+        trim_range(row.line, b, e);
+        out.minute = pickup_minute(row.line, b);
+        out.minutes = pack_pickup_time(row.line, b, out.hour, out.minute);
+    }
+
+    int dropoff = -1, distance = -1, fare = -1;
+    if (!schema.probeTime && timeColumn == schema.timeColumn) {
+        dropoff = schema.dropoffColumn;
+        distance = schema.distanceColumn;
+        fare = schema.fareColumn;
+    } else if (timeColumn == 3) {
+        dropoff = 2;
+        distance = 4;
+        fare = 5;
+    }
+    if (wants.dropoff) out.dropoff = field_view(row, dropoff);
+    if (wants.measures) {
+        out.distance = measure_field(row, distance);
+        out.fare = measure_field(row, fare);
+    }
+}
+
+static ParsedRow parse_row(const csv::Row& row, const CsvSchema& schema, ParseWants wants) {
+    ParsedRow out;
+    const string_view line = row.line;
+    if (line.empty()) return out;
 
-        int hour = -1;
+    size_t z_b = 0, z_e = 0;
+    if (!row.field((size_t)schema.zoneColumn, z_b, z_e)) return out;
+    trim_range(line, z_b, z_e);
+    if (z_b >= z_e) return out;
+
+    int hour = -1;
+    bool slow = false;
+    int timeColumn;
+    TimeStatus st;
+    if (schema.probeTime) {
         // Supports both:
         // - 3 columns: time in field 2
         // - 6 columns: time in field 3 (field 2 is dropoff zone, parse fails)
-        bool ok = parse_hour_field_candidate(line, commas, 2, hour);
-        if (!ok) ok = parse_hour_field_candidate(line, commas, 3, hour);
-        if (!ok) continue;
+        timeColumn = 2;
+        st = parse_hour_field_candidate(row, 2, hour, slow);
+        if (st != TimeStatus::Ok && parse_hour_field_candidate(row, 3, hour, slow) == TimeStatus::Ok) {
+            st = TimeStatus::Ok;
+            timeColumn = 3;
+        }
+    } else {
+        timeColumn = schema.timeColumn;
+        st = parse_hour_field_candidate(row, (size_t)schema.timeColumn, hour, slow);
+        // A locked 3/6-column layout still accepts the odd row written in the
+        // other one; only rows that miss the locked column pay for this.
+        if (st != TimeStatus::Ok && (schema.timeColumn == 2 || schema.timeColumn == 3) &&
+            parse_hour_field_candidate(row, (size_t)(5 - schema.timeColumn), hour, slow) == TimeStatus::Ok) {
+            st = TimeStatus::Ok;
+            timeColumn = 5 - schema.timeColumn;
+        }
+    }
+    if (st != TimeStatus::Ok) {
+        out.status = reject_reason(st);   // reported for the primary time column
+        return out;
+    }
+
+    out.zone = line.substr(z_b, z_e - z_b);
+    out.hour = hour;
+    out.slow = slow;
+    out.status = ParsedRow::Accepted;
+    if (wants.any()) parse_wanted(row, schema, timeColumn, wants, out);
+    return out;
+}
+
+static void aggregate_row(const ParsedRow& p, TripTables& tables) {
+    IngestStats& st = tables.stats;
+    switch (p.status) {
+    case ParsedRow::Accepted: {
+        st.rowsAccepted += 1;
+        if (p.slow) st.slowPathRows += 1;
+        if (tables.approxCounters != 0) {
+            tables.countApprox(p.zone, p.hour);
+            break;
+        }
+        uint32_t id = tables.intern(p.zone);
+        tables.count(id, p.hour);
+        if (tables.buckets.enabled()) {
+            int32_t bucket;
+            if (tables.buckets.bucketOf(p.minutes, p.hour, p.minute, bucket)) tables.buckets.add(id, bucket);
+        }
+        if ((tables.keepRows || tables.buckets.dated()) && p.minutes == TripColumns::kNoValue) st.undatedRows += 1;
+        if (tables.keepRows || tables.countRoutes) {
+            uint32_t dropoff = p.dropoff.empty() ? TripColumns::kNoZone : tables.intern(p.dropoff);
+            if (tables.keepRows) tables.columns.push(id, p.hour, dropoff, p.minutes, p.distance, p.fare);
+            if (tables.countRoutes && dropoff != TripColumns::kNoZone) tables.routes.add(id, dropoff);
+        }
+        if (tables.keepMeasures) tables.measure(id, p.distance, p.fare);
+        if (tables.keepFareSketches) tables.sketchFare(id, p.fare);
+        break;
+    }
+    case ParsedRow::MissingZone: st.rejectedMissingZone += 1; break;
+    case ParsedRow::BadTime: st.rejectedBadTime += 1; break;
+    case ParsedRow::BadHour: st.rejectedBadHour += 1; break;
+    case ParsedRow::BadMinute: st.rejectedBadMinute += 1; break;
+    }
+}
+
+using Clock = chrono::steady_clock;
+
+static inline long long elapsed_ns(Clock::time_point a, Clock::time_point b) {
+    return (long long)chrono::duration_cast<chrono::nanoseconds>(b - a).count();
+}
+
+// Rows handled per split / parse / aggregate round; the clock is read once
+// per phase per batch, so timing costs a fraction of a nanosecond per row.
+static constexpr size_t kBatchRows = 128;
+
+// Split [data, data+size) into rows with the vectorized delimiter scanner and
+// run them through the parser in batches, timing each phase.
+static void ingest_buffer(const char* data, size_t size, const CsvSchema& schema, TripTables& tables) {
+    IngestStats& st = tables.stats;
+    csv::RowSplitter split(data, size);
+    csv::Row rows[kBatchRows];
+    ParsedRow parsed[kBatchRows];
+    const ParseWants wants(tables);
+
+    for (;;) {
+        auto t0 = Clock::now();
+        size_t n = split.next(rows, kBatchRows);
+        auto t1 = Clock::now();
+        st.splitNs += elapsed_ns(t0, t1);
+        if (n == 0) break;
 
-        string zone = line.substr(z_b, z_e - z_b);
+        for (size_t i = 0; i < n; ++i) parsed[i] = parse_row(rows[i], schema, wants);
+        auto t2 = Clock::now();
+        for (size_t i = 0; i < n; ++i) aggregate_row(parsed[i], tables);
+        auto t3 = Clock::now();
 
-        zoneCounts[zone] += 1;
-        slotCounts[make_slot_key(zone, hour)] += 1;
+        st.rowsSeen += (long long)n;
+        st.parseNs += elapsed_ns(t1, t2);
+        st.aggregateNs += elapsed_ns(t2, t3);
     }
 }
 
-vector<ZoneCount> TripAnalyzer::topZones(int k) const {
-    if (k <= 0 || zoneCounts.empty()) return {};
+// Rows sampled from the top of a file to pick the time column.
+static constexpr size_t kSchemaSampleRows = 64;
 
-    vector<ZoneCount> v;
-    v.reserve(zoneCounts.size());
-    for (const auto& kv : zoneCounts) {
-        v.push_back(ZoneCount{kv.first, kv.second});
+// Column indices named by a header row such as
+// "TripID,PickupZoneID,DropoffZoneID,PickupTime,...". Pickup-qualified names
+// win over bare "zone"/"time" ones; "dropoff" zones are never the pickup
+// zone. False unless both columns are found and no field of the row parses as
+// a timestamp (so data rows are never taken).
+static bool schema_from_header(const csv::Row& row, CsvSchema& out) {
+    int zone = -1, time = -1, pickupZone = -1, pickupTime = -1;
+    int dropoff = -1, distance = -1, fare = -1;
+    size_t b = 0, e = 0;
+    string name;
+    for (size_t i = 0; row.field(i, b, e); ++i) {
+        trim_range(row.line, b, e);
+        int hour = 0;
+        if (parse_hour_from_datetime(row.line, b, e, hour) == TimeStatus::Ok) return false;
+
+        name.assign(row.line.substr(b, e - b));
+        for (char& c : name) c = (char)std::tolower((unsigned char)c);
+        bool pickup = name.find("pickup") != string::npos;
+        if (name.find("zone") != string::npos) {
+            if (name.find("dropoff") != string::npos) {
+                if (dropoff < 0) dropoff = (int)i;
+            } else {
+                if (zone < 0) zone = (int)i;
+                if (pickup && pickupZone < 0) pickupZone = (int)i;
+            }
+        } else if (name.find("time") != string::npos) {
+            if (time < 0) time = (int)i;
+            if (pickup && pickupTime < 0) pickupTime = (int)i;
+        } else if (name.find("dist") != string::npos) {
+            if (distance < 0) distance = (int)i;
+        } else if (name.find("fare") != string::npos) {
+            if (fare < 0) fare = (int)i;
+        }
+    }
+    if (pickupZone >= 0) zone = pickupZone;
+    if (pickupTime >= 0) time = pickupTime;
+    if (zone < 0 || time < 0) return false;
+
+    out.zoneColumn = zone;
+    out.timeColumn = time;
+    out.probeTime = false;
+    out.dropoffColumn = dropoff;
+    out.distanceColumn = distance;
+    out.fareColumn = fare;
+    return true;
+}
+
+// Detect the layout from the first kSchemaSampleRows lines of [data, data+size).
+// A header row fixes it by name; otherwise the time column is whichever of
+// fields 2 and 3 parses on more sampled rows. With no evidence either way the
+// schema keeps per-row probing. Returns the byte length of the header row to
+// skip (0 when there is none).
+static size_t detect_schema(const char* data, size_t size, CsvSchema& schema) {
+    schema = CsvSchema{};
+
+    size_t prefix = 0;
+    for (size_t n = 0; n < kSchemaSampleRows && prefix < size; ++n) {
+        const void* nl = memchr(data + prefix, '\n', size - prefix);
+        prefix = nl ? (size_t)(static_cast<const char*>(nl) - data) + 1 : size;
+    }
+
+    size_t headerLen = 0;
+    bool first = true;
+    long long hits2 = 0, hits3 = 0;
+    csv::for_each_row(data, prefix, [&](const csv::Row& row) {
+        if (first) {
+            first = false;
+            if (schema_from_header(row, schema)) {
+                headerLen = min(row.line.size() + 1, size);
+                return;
+            }
+        }
+        if (!schema.probeTime) return;
+        int hour = 0;
+        bool slow = false;
+        if (parse_hour_field_candidate(row, 2, hour, slow) == TimeStatus::Ok) ++hits2;
+        if (parse_hour_field_candidate(row, 3, hour, slow) == TimeStatus::Ok) ++hits3;
+    });
+
+    if (schema.probeTime && (hits2 > 0 || hits3 > 0)) {
+        schema.timeColumn = hits3 > hits2 ? 3 : 2;
+        schema.probeTime = false;
+        if (schema.timeColumn == 3) {
+            schema.dropoffColumn = 2;
+            schema.distanceColumn = 4;
+            schema.fareColumn = 5;
+        }
+    }
+    return headerLen;
+}
+
+// Prefix of a buffer sampled by setPresize().
+static constexpr size_t kPresizeSampleBytes = 4 << 20;
+
+struct SizeEstimate {
+    size_t rows = 0;
+    size_t zones = 0;
+    size_t avgZoneBytes = 8;
+};
+
+// Estimate rows and distinct zones of [data, data+size) from its first
+// kPresizeSampleBytes. Rows scale with bytes. Distinct zones are counted with
+// HyperLogLog at the half-way point and the end of the sample; the growth
+// between the two fits d(n) ~ n^a, which is extrapolated to the full row
+// count (a = 1 for all-unique zones, a = 0 once the zone set saturates).
+static SizeEstimate estimate_sizes(const char* data, size_t size, const CsvSchema& schema) {
+    SizeEstimate est;
+    size_t prefix = size;
+    if (size > kPresizeSampleBytes) {
+        prefix = kPresizeSampleBytes;
+        while (prefix > 0 && data[prefix - 1] != '\n') --prefix;
+        if (prefix == 0) prefix = kPresizeSampleBytes;
+    }
+
+    HyperLogLog hll;
+    size_t rows = 0, zoneRows = 0, zoneBytes = 0;
+    size_t halfRows = 0;
+    double halfZones = 0.0;
+    csv::for_each_row(data, prefix, [&](const csv::Row& row) {
+        ++rows;
+        size_t b = 0, e = 0;
+        if (row.field((size_t)schema.zoneColumn, b, e)) {
+            trim_range(row.line, b, e);
+            if (b < e) {
+                hll.add(FlatIndex::hash(row.line.substr(b, e - b)));
+                ++zoneRows;
+                zoneBytes += e - b;
+            }
+        }
+        if (halfRows == 0 && (size_t)(row.line.data() - data) >= prefix / 2) {
+            halfRows = rows;
+            halfZones = hll.estimate();
+        }
+    });
+    if (rows == 0) return est;
+
+    double zones = hll.estimate();
+    est.rows = prefix == size ? rows : (size_t)((double)rows * (double)size / (double)prefix);
+    if (zoneRows) est.avgZoneBytes = zoneBytes / zoneRows + 1;
+
+    double scaled = zones;
+    if (prefix < size && halfRows > 0 && halfRows < rows && halfZones >= 1.0) {
+        double a = std::log(zones / halfZones) / std::log((double)rows / (double)halfRows);
+        a = std::min(1.0, std::max(0.0, a));
+        scaled = zones * std::pow((double)est.rows / (double)rows, a);
+    }
+    est.zones = (size_t)std::min(scaled, (double)est.rows) + 1;
+    return est;
+}
+
+// Grows a FlatIndex makes from `capacity` until it can hold n keys.
+static size_t grows_needed(size_t capacity, size_t n) {
+    size_t grows = 0;
+    size_t cap = capacity ? capacity : 16;
+    while (cap < n * 2) {
+        cap *= 2;
+        ++grows;
+    }
+    return grows;
+}
+
+// Bookkeeping once an append has parsed all its rows.
+static void finish_append(TripTables& tables) {
+    tables.stats.distinctZones = (long long)tables.pickupZones;
+    if (tables.countRoutes) tables.routes.finalize(tables.zones.size());
+}
+
+// Smallest byte range worth handing to its own worker thread.
+static constexpr size_t kMinChunkBytes = 1 << 20;
+
+// Parse [data, data+size) with up to `threads` workers. The buffer is cut into
+// equal byte ranges whose boundaries are pushed forward to the next '\n', so
+// every line belongs to exactly one range. Each worker fills private tables;
+// they are merged in range order once all workers finish.
+// `hint`, when given, pre-sizes the worker tables.
+static void ingest_parallel(const char* data, size_t size, unsigned threads,
+                            const CsvSchema& schema, TripTables& tables,
+                            const SizeEstimate* hint = nullptr) {
+    size_t maxChunks = size / kMinChunkBytes;
+    if (maxChunks < 1) maxChunks = 1;
+    size_t n = min<size_t>(threads, maxChunks);
+    if (n <= 1) {
+        ingest_buffer(data, size, schema, tables);
+        return;
+    }
+
+    vector<size_t> bounds(n + 1, size);
+    bounds[0] = 0;
+    for (size_t i = 1; i < n; ++i) {
+        size_t pos = max(size / n * i, bounds[i - 1]);
+        const void* nl = pos < size ? memchr(data + pos, '\n', size - pos) : nullptr;
+        bounds[i] = nl ? (size_t)(static_cast<const char*>(nl) - data) + 1 : size;
+    }
+
+    // Heavy-hitter workers share the half of the budget the resident
+    // summaries leave free.
+    size_t workerCounters = max<size_t>(1, SpaceSaving::capacityFor(tables.approxBytes / 4 / (n - 1)));
+
+    vector<TripTables> parts(n);
+    vector<thread> workers;
+    workers.reserve(n - 1);
+    for (size_t i = 1; i < n; ++i) {
+        workers.emplace_back([&, i] {
+            parts[i].keepRows = tables.keepRows;
+            parts[i].buckets.setUnit(tables.buckets.unit());
+            parts[i].countRoutes = tables.countRoutes;
+            parts[i].keepMeasures = tables.keepMeasures;
+            parts[i].keepFareSketches = tables.keepFareSketches;
+            if (tables.approxCounters != 0) parts[i].setApproximate(workerCounters);
+            if (hint) parts[i].reserve(hint->zones / n + 1, hint->avgZoneBytes);
+            ingest_buffer(data + bounds[i], bounds[i + 1] - bounds[i], schema, parts[i]);
+        });
+    }
+    // The calling thread takes the first range straight into the result.
+    ingest_buffer(data, bounds[1], schema, tables);
+    for (auto& w : workers) w.join();
+
+    // Each worker's tables are freed as soon as they are merged.
+    for (size_t i = 1; i < n; ++i) {
+        tables.merge(parts[i]);
+        parts[i] = TripTables();
+    }
+}
+
+// Read size for stream input; each block is parsed (and split across workers)
+// as soon as it arrives.
+static constexpr size_t kStreamBlockBytes = 4 << 20;
+
+// Read-only mapping of a regular file. `regular` is false when the path could
+// not be opened or is not a regular file (pipe, tty, /dev/stdin, ...), in which
+// case the caller falls back to stream reading.
+class MappedFile {
+public:
+    explicit MappedFile(const string& path) {
+#ifdef TRIP_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            size_ = (size_t)st.st_size;
+            if (size_ == 0) {
+                regular_ = true;
+            } else {
+                void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    ::madvise(p, size_, MADV_SEQUENTIAL);
+                    data_ = static_cast<const char*>(p);
+                    regular_ = true;
+                }
+            }
+        }
+        ::close(fd);
+#else
+        (void)path;
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef TRIP_HAVE_MMAP
+        if (data_) ::munmap(const_cast<char*>(data_), size_);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool regular() const { return regular_; }
+    const char* data() const { return data_; }
+    size_t size() const { return data_ ? size_ : 0; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool regular_ = false;
+};
+
+// Snapshot layout (saveSnapshot / loadSnapshot), native byte order, every
+// section 8-byte aligned so a mapping can be read in place. Only the zone
+// dictionary and trip counts are kept: stats other than distinctZones,
+// retained rows, bucket and route counts, measures and fare sketches are
+// not. A load rejects a file of another version, byte order or size and
+// then leaves the current counts untouched.
+//   SnapshotHeader
+//   uint64_t keyEnd[zones]           end offset of each zone name in the key bytes
+//   int64_t  counts[zones][25]       trips, then the 24 hourly counts
+//   char     keys[keyBytes]          zone names back to back, in id order
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t zones;
+    uint64_t keyBytes;
+};
+
+static constexpr char kSnapshotMagic[8] = {'T', 'R', 'I', 'P', 'S', 'N', 'A', 'P'};
+static constexpr uint32_t kSnapshotVersion = 1;
+static constexpr uint32_t kSnapshotByteOrder = 0x01020304;
+static constexpr size_t kSnapshotCounts = 25;
+
+static uint64_t snapshot_size(uint64_t zones, uint64_t keyBytes) {
+    return sizeof(SnapshotHeader) + zones * 8 + zones * kSnapshotCounts * 8 + keyBytes;
+}
+
+// Rebuild tables from a mapped snapshot. False, leaving `out` partly filled,
+// when the header, sizes or names do not check out.
+static bool read_snapshot(const char* data, size_t size, TripTables& out) {
+    SnapshotHeader h;
+    if (size < sizeof h) return false;
+    memcpy(&h, data, sizeof h);
+    if (memcmp(h.magic, kSnapshotMagic, sizeof h.magic) != 0 || h.version != kSnapshotVersion ||
+        h.byteOrder != kSnapshotByteOrder || h.zones > UINT32_MAX || h.keyBytes > size ||
+        snapshot_size(h.zones, h.keyBytes) != size) {
+        return false;
+    }
+
+    const char* ends = data + sizeof h;
+    const char* counts = ends + h.zones * 8;
+    const char* keys = counts + h.zones * kSnapshotCounts * 8;
+    out.zones.reserve(h.zones, h.zones ? h.keyBytes / h.zones + 1 : 8);
+    out.tallies.reserve(h.zones);
+
+    uint64_t begin = 0;
+    for (uint64_t id = 0; id < h.zones; ++id) {
+        uint64_t end;
+        memcpy(&end, ends + id * 8, 8);
+        if (end < begin || end > h.keyBytes || end - begin > UINT32_MAX) return false;
+        if (out.intern(string_view(keys + begin, end - begin)) != id) return false;   // duplicate name
+        begin = end;
+
+        ZoneTally& t = out.tallies[id];
+        memcpy(&t.trips, counts + id * kSnapshotCounts * 8, 8);
+        memcpy(t.hourly.data(), counts + id * kSnapshotCounts * 8 + 8, 24 * 8);
+        if (t.trips != 0) ++out.pickupZones;
     }
+    return begin == h.keyBytes;
+}
+
+// Top k pickup zones by one measure of ZoneMeasures, the way topZones ranks
+// trip counts. Zones with no rows for the measure are left out.
+static vector<ZoneMetric> top_by_measure(const TripTables& tables, unsigned threads, int k,
+                                         MeasureRange ZoneMeasures::*measure, bool average) {
+    if (k <= 0 || tables.measures.empty()) return {};
+
+    const ZoneDictionary& zones = tables.zones;
+    auto better = [&zones, average](const MeasureRank& a, const MeasureRank& b) {
+        return better_measure(zones, average, a, b);
+    };
+    auto fill = [&tables, measure](size_t begin, size_t end, vector<MeasureRank>& out) {
+        for (size_t id = begin; id < end; ++id) {
+            const MeasureRange& m = tables.measures[id].*measure;
+            if (m.rows != 0) out.push_back(MeasureRank{m.sum, m.rows, (uint32_t)id});
+        }
+    };
+    vector<MeasureRank> top = select_top<MeasureRank>(tables.measures.size(), (size_t)k, threads, fill, better);
+
+    vector<ZoneMetric> v;
+    v.reserve(top.size());
+    for (const MeasureRank& r : top) {
+        double value = average ? (double)r.sum / (double)r.rows : (double)r.sum;
+        v.push_back(ZoneMetric{string(zones.name(r.id)), value, r.sum, r.rows});
+    }
+    return v;
+}
+
+} // namespace
+
+void TripAnalyzer::ingestFile(const std::string& csvPath) {
+    reset();
+    appendFile(csvPath);
+}
+
+void TripAnalyzer::ingestBuffer(const char* data, size_t size) {
+    reset();
+    appendBuffer(data, size);
+}
+
+void TripAnalyzer::ingestStream(std::istream& in) {
+    reset();
+    appendStream(in);
+}
 
-    if ((int)v.size() <= k) {
-        sort(v.begin(), v.end(), better_zone);
+void TripAnalyzer::reset() {
+    tables.clear();
+    layout = CsvSchema{};
+}
+
+void TripAnalyzer::appendBuffer(const char* data, size_t size) {
+    layout = CsvSchema{};
+    if (!data || size == 0) return;
+    tables.stats.bytesRead += (long long)size;
+    size_t skip = mixedSchema ? 0 : detect_schema(data, size, layout);
+
+    // The dictionary is not filled in heavy-hitter mode, so there is nothing to size.
+    bool sized = presize && tables.approxCounters == 0;
+    SizeEstimate est;
+    size_t capBefore = 0, rehashBefore = 0;
+    if (sized) {
+        est = estimate_sizes(data + skip, size - skip, layout);
+        tables.stats.estimatedRows = (long long)est.rows;
+        tables.stats.estimatedZones = (long long)est.zones;
+        capBefore = tables.zones.indexCapacity();
+        rehashBefore = tables.zones.rehashes();
+        tables.reserve(tables.zones.size() + est.zones, est.avgZoneBytes);
+    }
+
+    ingest_parallel(data + skip, size - skip, threads, layout, tables, sized ? &est : nullptr);
+
+    if (sized) {
+        long long wouldHave = (long long)grows_needed(capBefore, tables.zones.size());
+        long long did = (long long)(tables.zones.rehashes() - rehashBefore);
+        tables.stats.rehashesAvoided += max(0LL, wouldHave - did);
+    }
+    finish_append(tables);
+}
+
+void TripAnalyzer::appendFile(const std::string& csvPath) {
+    auto t0 = Clock::now();
+    MappedFile mapped(csvPath);
+    tables.stats.readNs += elapsed_ns(t0, Clock::now());
+    if (mapped.regular()) {
+        appendBuffer(mapped.data(), mapped.size());
+        return;
+    }
+
+    ifstream file(csvPath, ios::binary);
+    if (!file.is_open()) return;
+    appendStream(file);
+}
+
+void TripAnalyzer::appendStream(std::istream& in) {
+    layout = CsvSchema{};
+    bool detected = mixedSchema;
+
+    // Read fixed-size blocks and parse every complete line in them; the
+    // unterminated tail is carried into the next block.
+    string buf;
+    size_t carry = 0;
+    for (;;) {
+        buf.resize(carry + kStreamBlockBytes);
+        auto t0 = Clock::now();
+        in.read(&buf[carry], (streamsize)kStreamBlockBytes);
+        tables.stats.readNs += elapsed_ns(t0, Clock::now());
+        tables.stats.bytesRead += (long long)in.gcount();
+        size_t size = carry + (size_t)in.gcount();
+        bool eof = !in;
+
+        size_t end = size;
+        if (!eof) {
+            size_t nl = buf.rfind('\n', size - 1);
+            end = nl == string::npos ? 0 : nl + 1;
+        }
+
+        size_t skip = 0;
+        if (!detected && end > 0) {
+            skip = detect_schema(buf.data(), end, layout);
+            detected = true;
+        }
+        if (end > skip) ingest_parallel(buf.data() + skip, end - skip, threads, layout, tables);
+        if (eof) break;
+
+        carry = size - end;
+        if (carry > 0 && end > 0) memmove(&buf[0], &buf[end], carry);
+    }
+    finish_append(tables);
+}
+
+void TripAnalyzer::setThreadCount(unsigned n) {
+    if (n == 0) n = thread::hardware_concurrency();
+    threads = n ? n : 1;
+}
+
+void TripAnalyzer::setTopKCapacity(size_t k) {
+    tables.setTopCapacity(k);
+}
+
+vector<ZoneCount> TripAnalyzer::topZones(int k) const {
+    if (tables.approxCounters != 0) {
+        vector<ZoneCount> v;
+        for (ZoneEstimate& e : topZonesApprox(k)) v.push_back(ZoneCount{std::move(e.zone), e.count});
         return v;
     }
+    if (k <= 0 || tables.pickupZones == 0) return {};
 
-    auto nth = v.begin() + k;
-    nth_element(v.begin(), nth, v.end(), better_zone);
-    v.resize(k);
-    sort(v.begin(), v.end(), better_zone);
+    const ZoneDictionary& zones = tables.zones;
+    auto better = [&zones](const ZoneRank& a, const ZoneRank& b) { return better_zone(zones, a, b); };
+    vector<ZoneRank> top;
+    if ((size_t)k <= tables.zoneTop.capacity()) {
+        // Every zone that can make the top k is already in the index.
+        for (uint32_t id : tables.zoneTop.members()) top.push_back(ZoneRank{tables.tallies[id].trips, id});
+        keep_top(top, (size_t)k, better);
+        sort(top.begin(), top.end(), better);
+    } else {
+        auto fill = [this](size_t begin, size_t end, vector<ZoneRank>& out) {
+            out.reserve(end - begin);
+            for (size_t id = begin; id < end; ++id) {
+                long long trips = tables.tallies[id].trips;
+                if (trips != 0) out.push_back(ZoneRank{trips, (uint32_t)id});   // skip dropoff-only zones
+            }
+        };
+        top = select_top<ZoneRank>(zones.size(), (size_t)k, threads, fill, better);
+    }
+
+    // Only the winners get their names copied out.
+    vector<ZoneCount> v;
+    v.reserve(top.size());
+    for (const ZoneRank& r : top) v.push_back(ZoneCount{string(zones.name(r.id)), r.count});
     return v;
 }
 
 vector<SlotCount> TripAnalyzer::topBusySlots(int k) const {
-    if (k <= 0 || slotCounts.empty()) return {};
+    if (tables.approxCounters != 0) {
+        vector<SlotCount> v;
+        for (SlotEstimate& e : topBusySlotsApprox(k)) v.push_back(SlotCount{std::move(e.zone), e.hour, e.count});
+        return v;
+    }
+    if (k <= 0 || tables.zones.empty()) return {};
+
+    const ZoneDictionary& zones = tables.zones;
+    auto better = [&zones](const SlotRank& a, const SlotRank& b) { return better_slot(zones, a, b); };
+    vector<SlotRank> top;
+    if ((size_t)k <= tables.slotTop.capacity()) {
+        for (uint32_t slot : tables.slotTop.members()) {
+            top.push_back(SlotRank{tables.tallies[slot / 24].hourly[slot % 24], slot});
+        }
+        keep_top(top, (size_t)k, better);
+        sort(top.begin(), top.end(), better);
+    } else {
+        auto fill = [this](size_t begin, size_t end, vector<SlotRank>& out) {
+            out.reserve(end - begin);
+            for (size_t id = begin; id < end; ++id) {
+                const auto& hourly = tables.tallies[id].hourly;
+                for (uint32_t h = 0; h < 24; ++h) {
+                    if (hourly[h] != 0) out.push_back(SlotRank{hourly[h], (uint32_t)id * 24 + h});
+                }
+            }
+        };
+        top = select_top<SlotRank>(zones.size(), (size_t)k, threads, fill, better);
+    }
 
     vector<SlotCount> v;
-    v.reserve(slotCounts.size());
+    v.reserve(top.size());
+    for (const SlotRank& r : top) v.push_back(SlotCount{string(zones.name(r.slot / 24)), (int)(r.slot % 24), r.count});
+    return v;
+}
 
-    string zone;
-    int hour = -1;
-    for (const auto& kv : slotCounts) {
-        zone.clear();
-        hour = -1;
-        if (!parse_key_zone_hour(kv.first, zone, hour)) continue;
-        v.push_back(SlotCount{zone, hour, kv.second});
+bool TripAnalyzer::saveSnapshot(const std::string& path) const {
+    if (tables.approxCounters != 0) return false;   // no dictionary or exact counts to write
+    const ZoneDictionary& zones = tables.zones;
+    SnapshotHeader h{};
+    memcpy(h.magic, kSnapshotMagic, sizeof h.magic);
+    h.version = kSnapshotVersion;
+    h.byteOrder = kSnapshotByteOrder;
+    h.zones = zones.size();
+
+    vector<uint64_t> ends(zones.size());
+    for (uint32_t id = 0; id < zones.size(); ++id) {
+        h.keyBytes += zones.name(id).size();
+        ends[id] = h.keyBytes;
+    }
+    vector<int64_t> counts;
+    counts.reserve(zones.size() * kSnapshotCounts);
+    for (const ZoneTally& t : tables.tallies) {
+        counts.push_back(t.trips);
+        counts.insert(counts.end(), t.hourly.begin(), t.hourly.end());
     }
 
-    if (v.empty()) return {};
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out.is_open()) return false;
+    out.write(reinterpret_cast<const char*>(&h), sizeof h);
+    out.write(reinterpret_cast<const char*>(ends.data()), (streamsize)(ends.size() * 8));
+    out.write(reinterpret_cast<const char*>(counts.data()), (streamsize)(counts.size() * 8));
+    for (uint32_t id = 0; id < zones.size(); ++id) {
+        string_view name = zones.name(id);
+        out.write(name.data(), (streamsize)name.size());
+    }
+    out.flush();
+    return out.good();
+}
 
-    if ((int)v.size() <= k) {
-        sort(v.begin(), v.end(), better_slot);
-        return v;
+bool TripAnalyzer::loadSnapshot(const std::string& path) {
+    MappedFile mapped(path);
+    const char* data = mapped.data();
+    size_t size = mapped.size();
+    string copy;
+    if (!mapped.regular()) {
+        ifstream in(path, ios::binary);
+        if (!in.is_open()) return false;
+        copy.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        data = copy.data();
+        size = copy.size();
     }
 
-    auto nth = v.begin() + k;
-    nth_element(v.begin(), nth, v.end(), better_slot);
-    v.resize(k);
-    sort(v.begin(), v.end(), better_slot);
+    TripTables loaded;
+    loaded.keepRows = tables.keepRows;
+    loaded.buckets.setUnit(tables.buckets.unit());
+    loaded.countRoutes = tables.countRoutes;
+    loaded.keepMeasures = tables.keepMeasures;
+    loaded.keepFareSketches = tables.keepFareSketches;
+    if (!read_snapshot(data, size, loaded)) return false;
+    loaded.stats.distinctZones = (long long)loaded.pickupZones;
+
+    // In heavy-hitter mode the snapshot's exact counts seed fresh summaries,
+    // and the dictionary and tallies are dropped once they have.
+    if (tables.approxCounters != 0) {
+        TripTables seeded;
+        seeded.approxBytes = tables.approxBytes;
+        seeded.setApproximate(tables.approxCounters);
+        seeded.stats = loaded.stats;
+        seeded.stats.distinctZones = 0;
+        for (uint32_t id = 0; id < loaded.zones.size(); ++id) {
+            const ZoneTally& t = loaded.tallies[id];
+            if (t.trips == 0) continue;
+            seeded.heavyZones.add(loaded.zones.name(id), t.trips);
+            for (int h = 0; h < 24; ++h) {
+                if (t.hourly[h] != 0) seeded.countApprox(loaded.zones.name(id), h, t.hourly[h]);
+            }
+        }
+        loaded = std::move(seeded);
+    }
+
+    size_t topCapacity = tables.zoneTop.capacity();
+    tables = std::move(loaded);
+    tables.setTopCapacity(topCapacity);
+    layout = CsvSchema{};
+    return true;
+}
+
+void TripAnalyzer::setTimeBucket(TimeBucket unit) {
+    tables.buckets.setUnit(unit);
+}
+
+vector<BucketCount> TripAnalyzer::topBusyBuckets(int k) const {
+    const BucketCounts& buckets = tables.buckets;
+    if (k <= 0 || buckets.empty()) return {};
+
+    const ZoneDictionary& zones = tables.zones;
+    auto better = [&zones](const BucketRank& a, const BucketRank& b) { return better_bucket(zones, a, b); };
+    auto fill = [&buckets](size_t begin, size_t end, vector<BucketRank>& out) {
+        buckets.forEach(begin, end, [&out](uint32_t id, int32_t bucket, long long c) {
+            out.push_back(BucketRank{c, id, bucket});
+        });
+    };
+    vector<BucketRank> top = select_top<BucketRank>(buckets.positions(), (size_t)k, threads, fill, better);
+
+    vector<BucketCount> v;
+    v.reserve(top.size());
+    for (const BucketRank& r : top) {
+        v.push_back(BucketCount{string(zones.name(r.id)), r.bucket, r.count});
+    }
     return v;
 }
 
+void TripAnalyzer::setCountRoutes(bool on) {
+    tables.countRoutes = on;
+}
+
+vector<RouteCount> TripAnalyzer::topRoutes(int k) const {
+    const RouteCounts& routes = tables.routes;
+    if (k <= 0 || routes.rows() == 0) return {};
+
+    const ZoneDictionary& zones = tables.zones;
+    auto better = [&zones](const RouteRank& a, const RouteRank& b) { return better_route(zones, a, b); };
+    auto fill = [&routes](size_t begin, size_t end, vector<RouteRank>& out) {
+        out.reserve(routes.rowBegin(end) - routes.rowBegin(begin));
+        for (size_t p = begin; p < end; ++p) {
+            for (uint64_t i = routes.rowBegin(p); i < routes.rowEnd(p); ++i) {
+                out.push_back(RouteRank{routes.count(i), (uint32_t)p, routes.dropoff(i)});
+            }
+        }
+    };
+    vector<RouteRank> top = select_top<RouteRank>(routes.rows(), (size_t)k, threads, fill, better);
+
+    vector<RouteCount> v;
+    v.reserve(top.size());
+    for (const RouteRank& r : top) {
+        v.push_back(RouteCount{string(zones.name(r.pickup)), string(zones.name(r.dropoff)), r.count});
+    }
+    return v;
+}
+
+void TripAnalyzer::setTrackMeasures(bool on) {
+    tables.keepMeasures = on;
+}
+
+ZoneMeasures TripAnalyzer::zoneMeasures(std::string_view zone) const {
+    uint32_t id = tables.zones.find(zone);
+    if (id == FlatIndex::npos || id >= tables.measures.size()) return {};
+    return tables.measures[id];
+}
+
+void TripAnalyzer::setFareQuantiles(bool on) {
+    tables.keepFareSketches = on;
+}
+
+int32_t TripAnalyzer::fareQuantile(std::string_view zone, double q) const {
+    uint32_t id = tables.zones.find(zone);
+    if (id == FlatIndex::npos || id >= tables.fareSketches.size()) return TripColumns::kNoValue;
+    return tables.fareSketches[id].quantile(q);
+}
+
+// Pickups go to two Space-Saving summaries, zones and slots, so memory stays
+// flat however many distinct zones arrive. topZones / topBusySlots then
+// return estimates that may overcount but never undercount, and every key
+// seen more than approximateBound() times is present: at most rows /
+// approximateCounters() on one thread, up to the worker count times that
+// once smaller worker summaries are merged. The other per-zone options are
+// ignored, stats().distinctZones stays 0, saveSnapshot fails and
+// loadSnapshot seeds the summaries. Zone names past the string's inline
+// buffer cost their length on top of the budget.
+void TripAnalyzer::setApproximateMemory(size_t bytes) {
+    // A quarter each for the two resident summaries, all allocated up front;
+    // ingest workers share the other half. At least one counter per summary,
+    // so a tiny budget still counts something.
+    size_t counters = bytes == 0 ? 0 : max<size_t>(1, SpaceSaving::capacityFor(bytes / 4));
+    tables.approxBytes = bytes;
+    tables.setApproximate(counters);
+    reset();
+}
+
+long long TripAnalyzer::approximateBound() const {
+    return max(tables.heavyZones.untrackedBound(), tables.heavySlots.untrackedBound());
+}
+
+vector<ZoneEstimate> TripAnalyzer::topZonesApprox(int k) const {
+    if (k <= 0) return {};
+    vector<ZoneEstimate> v;
+    v.reserve(tables.heavyZones.size());
+    for (const SpaceSaving::Counter& c : tables.heavyZones.entries()) v.push_back(ZoneEstimate{c.key, c.count, c.error});
+    auto better = [](const ZoneEstimate& a, const ZoneEstimate& b) {
+        if (a.count != b.count) return a.count > b.count;
+        return a.zone < b.zone;
+    };
+    keep_top(v, (size_t)k, better);
+    sort(v.begin(), v.end(), better);
+    return v;
+}
+
+vector<SlotEstimate> TripAnalyzer::topBusySlotsApprox(int k) const {
+    if (k <= 0) return {};
+    vector<SlotEstimate> v;
+    v.reserve(tables.heavySlots.size());
+    for (const SpaceSaving::Counter& c : tables.heavySlots.entries()) {
+        // The last key byte is the hour.
+        v.push_back(SlotEstimate{c.key.substr(0, c.key.size() - 1), (int)c.key.back(), c.count, c.error});
+    }
+    auto better = [](const SlotEstimate& a, const SlotEstimate& b) {
+        if (a.count != b.count) return a.count > b.count;
+        if (a.zone != b.zone) return a.zone < b.zone;
+        return a.hour < b.hour;
+    };
+    keep_top(v, (size_t)k, better);
+    sort(v.begin(), v.end(), better);
+    return v;
+}
+
+vector<ZoneMetric> TripAnalyzer::topZonesByRevenue(int k) const {
+    return top_by_measure(tables, threads, k, &ZoneMeasures::fare, false);
+}
+
+vector<ZoneMetric> TripAnalyzer::topZonesByAvgFare(int k) const {
+    return top_by_measure(tables, threads, k, &ZoneMeasures::fare, true);
+}
+
+vector<ZoneMetric> TripAnalyzer::topZonesByDistance(int k) const {
+    return top_by_measure(tables, threads, k, &ZoneMeasures::distance, false);
+}
@@ -1,7 +1,11 @@
 #pragma once
+#include <iosfwd>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "trip_tables.h"
+
 struct ZoneCount {
     std::string zone;
     long long count;
@@ -13,14 +17,199 @@ struct SlotCount {
     long long count;
 };
 
+// A (zone, time bucket) count; see TimeBucket for bucket numbering.
+struct BucketCount {
+    std::string zone;
+    long long bucket;
+    long long count;
+};
+
+// A zone ranked by fare or distance. Sums are in hundredths (cents for
+// fares); `value` is the ranked quantity, the sum or sum / rows.
+struct ZoneMetric {
+    std::string zone;
+    double value;
+    long long sum;
+    long long rows;    // rows that had the measure
+};
+
+// Heavy-hitter estimates (setApproximateMemory): the true count lies in
+// [count - error, count].
+struct ZoneEstimate {
+    std::string zone;
+    long long count;
+    long long error;
+};
+
+struct SlotEstimate {
+    std::string zone;
+    int hour;
+    long long count;
+    long long error;
+};
+
+struct RouteCount {
+    std::string pickup;
+    std::string dropoff;
+    long long count;
+};
+
+// Column layout ingestFile parses with. It is detected once per file from the
+// header row, or from the first data rows when there is no header.
+// The dropoff, distance and fare columns are only read for retained rows;
+// -1 means absent. Rows whose time turns up in field 3 under probing or the
+// 3/6-column fallback use the SmallTrips.csv positions 2, 4 and 5.
+struct CsvSchema {
+    int zoneColumn = 1;
+    int timeColumn = 2;
+    bool probeTime = true;   // try field 2, then field 3, on every row
+    int dropoffColumn = -1;
+    int distanceColumn = -1;
+    int fareColumn = -1;
+};
+
 class TripAnalyzer {
 public:
-    // Parse Trips.csv, skip dirty rows, never crash
+    // Parse Trips.csv, skip dirty rows, never crash.
+    // Regular files are memory-mapped and scanned in place; pipes and other
+    // non-regular files are read through a stream instead.
+    // Files large enough to split are parsed by threadCount() workers, each
+    // over a newline-aligned byte range, and merged before returning.
+    // Replaces any previous counts; same as reset() followed by appendFile().
     void ingestFile(const std::string& csvPath);
 
+    // Same parser over CSV text already in memory or arriving on a stream,
+    // e.g. network-received or decompressed data. Both replace previous counts.
+    // Streams are read in 4 MiB blocks.
+    void ingestBuffer(const char* data, size_t size);
+    void ingestStream(std::istream& in);
+
+    // Add a file's, buffer's or stream's rows to the current counts. Each call
+    // detects its own layout and skips its own header row, so hourly
+    // partition files can be fed one after another.
+    void appendFile(const std::string& csvPath);
+    void appendBuffer(const char* data, size_t size);
+    void appendStream(std::istream& in);
+
+    // Drop all counts.
+    void reset();
+
+    // Write the zone and slot counts to a binary file, or replace the current
+    // counts with one written earlier; false on failure.
+    bool saveSnapshot(const std::string& path) const;
+    bool loadSnapshot(const std::string& path);
+
+    // Worker threads used by ingestFile, and by topZones / topBusySlots when k
+    // is past the top-K index and the table has at least 64K zones per thread
+    // (default 1). 0 selects std::thread::hardware_concurrency(). Results do
+    // not depend on it.
+    void setThreadCount(unsigned n);
+    unsigned threadCount() const { return threads; }
+
+    // Mixed-schema mode skips detection and probes field 2 then field 3 on
+    // every row, for inputs that interleave 3- and 6-column rows throughout.
+    // Off by default.
+    void setMixedSchema(bool on) { mixedSchema = on; }
+
+    // Before parsing a file or buffer, sample its first 4 MiB to estimate row
+    // count (from its size) and distinct zones (HyperLogLog), and reserve
+    // table capacity for them. Off by default; streams are never pre-sized.
+    void setPresize(bool on) { presize = on; }
+
+    // Keep every accepted row from later ingests and appends in a columnar
+    // store (rows()): pickup and dropoff zone ids, hour, timestamp, distance
+    // and fare, about 21 bytes per row. Off by default. Rows already ingested
+    // are not recovered by turning it on; turning it off keeps them until reset.
+    void setRetainRows(bool on) { tables.keepRows = on; }
+    const TripColumns& rows() const { return tables.columns; }
+
+    // Zone ids as stored in rows(). zoneId returns TripColumns::kNoZone for a
+    // zone never seen.
+    std::string_view zoneName(uint32_t id) const { return tables.zones.name(id); }
+    uint32_t zoneId(std::string_view zone) const { return tables.zones.find(zone); }
+
+    // Row, rejection, timing and sizing counters summed since the last reset.
+    const IngestStats& stats() const { return tables.stats; }
+
+    // Layout used by the most recent ingest or append.
+    const CsvSchema& schema() const { return layout; }
+
+    // Accepted rows since the last reset whose pickup time was not in the
+    // canonical "YYYY-MM-DD HH:MM" layout and went through the tolerant parser.
+    long long slowPathRows() const { return tables.stats.slowPathRows; }
+
+    // Size of the top-K index kept current during ingest; 0 (the default)
+    // disables it. Queries with k up to this size read only the index; larger
+    // k scan every zone.
+    void setTopKCapacity(size_t k);
+
     // Top K zones: count desc, zone asc
     std::vector<ZoneCount> topZones(int k = 10) const;
 
     // Top K slots: count desc, zone asc, hour asc
     std::vector<SlotCount> topBusySlots(int k = 10) const;
+
+    // Also count trips per zone and time bucket during later ingests and
+    // appends (default None). Changing it drops the bucket counts.
+    void setTimeBucket(TimeBucket unit);
+    TimeBucket timeBucket() const { return tables.buckets.unit(); }
+
+    // Top K (zone, bucket) pairs: count desc, zone asc, bucket asc
+    std::vector<BucketCount> topBusyBuckets(int k = 10) const;
+
+    // Also count pickup -> dropoff zone pairs during later ingests and
+    // appends, from the dropoff column of 6-column rows (off by default).
+    // Rows without a dropoff are left out.
+    void setCountRoutes(bool on);
+
+    // Top K routes: count desc, pickup asc, dropoff asc
+    std::vector<RouteCount> topRoutes(int k = 10) const;
+
+    // Also sum distance and fare per pickup zone, with their extremes, during
+    // later ingests and appends (off by default). Values are parsed as exact
+    // fixed-point hundredths (fixed_decimal.h), never through strtod.
+    void setTrackMeasures(bool on);
+
+    // Distance and fare totals of a pickup zone; all zero (rows == 0) for a
+    // zone never seen or while tracking was off.
+    ZoneMeasures zoneMeasures(std::string_view zone) const;
+
+    // Top K pickup zones by total fare, average fare and total distance, from
+    // the totals kept by setTrackMeasures (empty while it was off). Order:
+    // value desc, zone asc; averages are compared exactly, not as doubles.
+    std::vector<ZoneMetric> topZonesByRevenue(int k = 10) const;
+    std::vector<ZoneMetric> topZonesByAvgFare(int k = 10) const;
+    std::vector<ZoneMetric> topZonesByDistance(int k = 10) const;
+
+    // Also keep a KLL sketch of each pickup zone's fares during later ingests
+    // and appends (off by default): at most about 1.5 KiB of buffer per zone
+    // however many trips it has, plus the sketch itself, about 1% rank error.
+    // Worker sketches are merged.
+    void setFareQuantiles(bool on);
+
+    // Approximate q-quantile (0-1) of a zone's fares in hundredths; the exact
+    // minimum and maximum at q = 0 and 1. TripColumns::kNoValue for a zone
+    // with no sketched fares.
+    int32_t fareQuantile(std::string_view zone, double q) const;
+
+    // Count pickups in heavy-hitter summaries held within `bytes` instead of
+    // per-zone tables; 0 (the default) counts exactly. Drops all counts.
+    void setApproximateMemory(size_t bytes);
+    size_t approximateCounters() const { return tables.approxCounters; }
+
+    // Count that no zone or slot left out of the summaries can exceed; 0 in
+    // exact mode.
+    long long approximateBound() const;
+
+    // topZones / topBusySlots order by estimated count, each with its error
+    // bound. Empty in exact mode.
+    std::vector<ZoneEstimate> topZonesApprox(int k = 10) const;
+    std::vector<SlotEstimate> topBusySlotsApprox(int k = 10) const;
+
+private:
+    unsigned threads = 1;
+    bool mixedSchema = false;
+    bool presize = false;
+    CsvSchema layout;
+    TripTables tables;
 };
@@ -0,0 +1,441 @@
+// Benchmark harness for the analyzer. Not part of the graded build:
+//   make bench && ./bench [split] [table] [parse] [ingest] [topk]
+// With no arguments every section runs. Each measurement is repeated
+// BENCH_REPS times (default 7) and reported as median and p95.
+//
+// SPLIT:  SmallTrips.csv repeated to BENCH_ROWS rows (default 10,000,000),
+//         split by the old per-row vector loop and the block scanner.
+// TABLE:  zone interning through ZoneDictionary (FlatIndex) versus the
+//         unordered_map index it replaced, at the zone counts in BENCH_ZONES
+//         (default "1000,150000,10000000"). Single run per size.
+// PARSE:  BENCH_ROWS distance,fare pairs parsed in place by the fixed-point
+//         parser and by strtod + llround; both must agree.
+// INGEST: ingestFile on deterministic synthetic files shaped like the C1, C2
+//         and C3 tests plus a Zipf-distributed 6-column file; rows/s and
+//         bytes/s. BENCH_SCALE scales row counts, BENCH_THREADS sets workers
+//         here and in TOPK.
+// TOPK:   topZones / topBusySlots ns per call at several k on each dataset.
+#include "analyzer.h"
+#include "csv_scan.h"
+#include "fixed_decimal.h"
+#include "trip_tables.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+static long long env_ll(const char* name, long long def) {
+    const char* v = getenv(name);
+    return v ? strtoll(v, nullptr, 10) : def;
+}
+
+static double env_double(const char* name, double def) {
+    const char* v = getenv(name);
+    return v ? strtod(v, nullptr) : def;
+}
+
+// ---------------- harness ----------------
+
+struct Summary {
+    double median;
+    double p95;
+};
+
+static Summary summarize(vector<double> v) {
+    sort(v.begin(), v.end());
+    size_t n = v.size();
+    double median = n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+    size_t i95 = (size_t)ceil(0.95 * (double)n);
+    return Summary{median, v[i95 == 0 ? 0 : i95 - 1]};
+}
+
+// Run fn once to warm up, then `reps` timed runs; returns seconds per run.
+template <class Fn>
+static vector<double> repeat(int reps, Fn&& fn) {
+    fn();
+    vector<double> out;
+    out.reserve((size_t)reps);
+    for (int r = 0; r < reps; ++r) {
+        auto t0 = Clock::now();
+        fn();
+        out.push_back(chrono::duration<double>(Clock::now() - t0).count());
+    }
+    return out;
+}
+
+// splitmix64: small, fast and fully deterministic across platforms.
+struct Rng {
+    uint64_t s;
+    uint64_t next() {
+        uint64_t z = (s += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    double uniform() { return (double)(next() >> 11) * (1.0 / 9007199254740992.0); }
+};
+
+// ---------------- datasets ----------------
+
+struct Dataset {
+    string name;
+    fs::path path;
+    size_t rows = 0;
+    size_t bytes = 0;
+};
+
+static string zpad(long long n, int width) {
+    string s = to_string(n);
+    return s.size() >= (size_t)width ? s : string((size_t)width - s.size(), '0') + s;
+}
+
+static string hhmm(int h, int m) { return zpad(h, 2) + ":" + zpad(m, 2); }
+
+static Dataset write_dataset(const fs::path& dir, const string& name, const string& csv, size_t rows) {
+    Dataset d{name, dir / (name + ".csv"), rows, csv.size()};
+    ofstream(d.path, ios::binary) << csv;
+    return d;
+}
+
+// Every row a new zone (C1).
+static Dataset make_c1(const fs::path& dir, size_t n) {
+    string csv = "TripID,PickupZoneID,PickupTime\n";
+    for (size_t i = 0; i < n; ++i) csv += to_string(i + 1) + ",Z" + zpad((long long)i, 6) + ",2024-01-01 01:00\n";
+    return write_dataset(dir, "C1", csv, n);
+}
+
+// Four zones, hours cycling (C2).
+static Dataset make_c2(const fs::path& dir, size_t n) {
+    string csv = "TripID,PickupZoneID,PickupTime\n";
+    for (size_t i = 0; i < n; ++i) {
+        csv += to_string(i + 1) + ",Z" + to_string(i & 3) + ",2024-01-01 " + hhmm((int)(i % 24), 0) + "\n";
+    }
+    return write_dataset(dir, "C2", csv, n);
+}
+
+// One boosted slot ahead of five evenly spread zones (C3).
+static Dataset make_c3(const fs::path& dir, size_t n, size_t boost) {
+    string csv = "TripID,PickupZoneID,PickupTime\n";
+    long long id = 1;
+    for (size_t i = 0; i < boost; ++i) csv += to_string(id++) + ",Z2,2024-01-01 07:15\n";
+    for (size_t i = 0; i < n; ++i) {
+        csv += to_string(id++) + ",Z" + to_string(i % 5) + ",2024-01-01 " + hhmm((int)(i % 24), 0) + "\n";
+    }
+    return write_dataset(dir, "C3", csv, n + boost);
+}
+
+// 6-column rows (like SmallTrips.csv) with pickup zones drawn from a Zipf(s)
+// distribution over `zones` ids and uniform dropoff zones, dates and times.
+static Dataset make_zipf(const fs::path& dir, size_t n, size_t zones, double s) {
+    vector<double> cdf(zones);
+    double sum = 0;
+    for (size_t i = 0; i < zones; ++i) cdf[i] = (sum += 1.0 / pow((double)(i + 1), s));
+    for (double& c : cdf) c /= sum;
+
+    Rng rng{42};
+    string csv = "TripID,PickupZoneID,DropoffZoneID,PickupTime,Distance,Fare\n";
+    for (size_t i = 0; i < n; ++i) {
+        size_t z = (size_t)(lower_bound(cdf.begin(), cdf.end(), rng.uniform()) - cdf.begin());
+        if (z >= zones) z = zones - 1;
+        uint64_t r = rng.next();
+        int month = (int)(r % 12) + 1, day = (int)((r >> 8) % 28) + 1;
+        int hour = (int)((r >> 16) % 24), minute = (int)((r >> 24) % 60);
+        int tenths = (int)((r >> 32) % 500) + 1;
+        csv += to_string(i + 1000000) + ",ZONE" + zpad((long long)z, 6) + ",ZONE" +
+               zpad((long long)((r >> 40) % zones), 6) + ",2024-" + zpad(month, 2) + "-" + zpad(day, 2) + " " +
+               hhmm(hour, minute) + "," + to_string(tenths / 10) + "." + to_string(tenths % 10) + "," +
+               to_string(tenths / 3) + "." + to_string(tenths % 10) + "\n";
+    }
+    return write_dataset(dir, "ZIPF", csv, n);
+}
+
+// ---------------- SPLIT ----------------
+
+static string load_scaled(const char* path, size_t rows) {
+    ifstream in(path, ios::binary);
+    stringstream ss;
+    ss << in.rdbuf();
+    string src = ss.str();
+    if (src.empty()) return {};
+    if (src.back() != '\n') src.push_back('\n');
+
+    size_t srcRows = 0;
+    for (char c : src) srcRows += (c == '\n');
+
+    string out;
+    out.reserve(src.size() * (rows / srcRows + 1));
+    size_t have = 0;
+    while (have + srcRows <= rows) {
+        out += src;
+        have += srcRows;
+    }
+    for (size_t p = 0; have < rows; ++have) {
+        size_t nl = src.find('\n', p);
+        out.append(src, p, nl + 1 - p);
+        p = nl + 1;
+    }
+    return out;
+}
+
+// The splitter ingestFile used before the block scanner: memchr for the line,
+// then a fresh vector of comma offsets filled byte by byte.
+static unsigned long long split_per_row_vector(const string& buf) {
+    unsigned long long sum = 0;
+    const char* p = buf.data();
+    const char* end = p + buf.size();
+    while (p < end) {
+        const char* nl = static_cast<const char*>(memchr(p, '\n', (size_t)(end - p)));
+        const char* le = nl ? nl : end;
+        vector<size_t> commas;
+        commas.reserve(8);
+        for (const char* c = p; c < le; ++c) {
+            if (*c == ',') commas.push_back((size_t)(c - p));
+        }
+        for (size_t c : commas) sum += c;
+        p = nl ? nl + 1 : end;
+    }
+    return sum;
+}
+
+static unsigned long long split_block(const string& buf, csv::BlockScanner scan) {
+    unsigned long long sum = 0;
+    csv::for_each_row(buf.data(), buf.size(), [&](const csv::Row& row) {
+        size_t n = row.ncommas < csv::Row::kMaxCommas ? row.ncommas : csv::Row::kMaxCommas;
+        for (size_t i = 0; i < n; ++i) sum += row.commas[i];
+    }, scan);
+    return sum;
+}
+
+static void bench_split(int reps) {
+    size_t rows = (size_t)env_ll("BENCH_ROWS", 10000000);
+    string buf = load_scaled("SmallTrips.csv", rows);
+    if (buf.empty()) {
+        printf("SPLIT skipped: SmallTrips.csv not found or empty\n");
+        return;
+    }
+    printf("SPLIT rows=%zu bytes=%zu scanner=%s\n", rows, buf.size(), csv::active_scanner_name());
+    printf("  %-18s %10s %10s %10s %10s\n", "variant", "median_ms", "p95_ms", "Mrows/s", "MB/s");
+
+    auto row = [&](const char* name, auto&& fn) {
+        volatile unsigned long long sink = 0;
+        Summary s = summarize(repeat(reps, [&] { sink = sink + fn(); }));
+        printf("  %-18s %10.1f %10.1f %10.1f %10.1f\n", name, s.median * 1e3, s.p95 * 1e3,
+               (double)rows / s.median / 1e6, (double)buf.size() / s.median / 1e6);
+    };
+    row("per-row vector", [&] { return split_per_row_vector(buf); });
+    row("block scalar", [&] { return split_block(buf, csv::scan_block_scalar); });
+    row("block active", [&] { return split_block(buf, csv::active_scanner()); });
+}
+
+// ---------------- TABLE ----------------
+
+// The zone dictionary before FlatIndex: node-based map keyed by views into a
+// deque of owned names.
+class StdMapDictionary {
+public:
+    StdMapDictionary() { index.max_load_factor(0.5f); }
+
+    uint32_t intern(string_view zone) {
+        auto it = index.find(zone);
+        if (it != index.end()) return it->second;
+        uint32_t id = (uint32_t)names.size();
+        names.emplace_back(zone);
+        index.emplace(names.back(), id);
+        return id;
+    }
+
+private:
+    deque<string> names;
+    unordered_map<string_view, uint32_t> index;
+};
+
+// Intern `zones` distinct keys, then look up 10M keys (at least every key
+// once more) in a scattered order. Reports ns per operation for each phase.
+template <class Dict>
+static void bench_dictionary(const char* name, const vector<string>& keys) {
+    const size_t n = keys.size();
+    const size_t lookups = max<size_t>(n, 10000000);
+
+    auto t0 = Clock::now();
+    Dict dict;
+    unsigned long long check = 0;
+    for (const auto& k : keys) check += dict.intern(k);
+    auto t1 = Clock::now();
+    size_t idx = 0;
+    const size_t stride = 7919;   // prime, so the walk visits every key
+    for (size_t i = 0; i < lookups; ++i) {
+        check += dict.intern(keys[idx]);
+        idx += stride;
+        if (idx >= n) idx %= n;
+    }
+    auto t2 = Clock::now();
+
+    double insNs = chrono::duration<double, nano>(t1 - t0).count() / (double)n;
+    double hitNs = chrono::duration<double, nano>(t2 - t1).count() / (double)lookups;
+    printf("  %-18s zones=%-9zu insert %7.1f ns/op  lookup %7.1f ns/op  (check=%llu)\n",
+           name, n, insNs, hitNs, check);
+}
+
+static void bench_table() {
+    const char* env = getenv("BENCH_ZONES");
+    const char* list = env ? env : "1000,150000,10000000";
+    printf("TABLE\n");
+    for (const char* p = list; *p;) {
+        char* after = nullptr;
+        size_t zones = strtoull(p, &after, 10);
+        p = *after == ',' ? after + 1 : after;
+        if (zones == 0) break;
+
+        vector<string> keys;
+        keys.reserve(zones);
+        char buf[32];
+        for (size_t i = 0; i < zones; ++i) {
+            snprintf(buf, sizeof buf, "ZONE%08zu", i);
+            keys.emplace_back(buf);
+        }
+        bench_dictionary<StdMapDictionary>("unordered_map", keys);
+        bench_dictionary<ZoneDictionary>("FlatIndex", keys);
+    }
+}
+
+// ---------------- PARSE ----------------
+
+static void bench_parse(int reps) {
+    const size_t rows = (size_t)env_ll("BENCH_ROWS", 10000000);
+    Rng rng{7};
+    string buf;
+    vector<size_t> starts;   // field i is [starts[i], starts[i + 1] - 1)
+    buf.reserve(rows * 12);
+    starts.reserve(rows * 2 + 1);
+    for (size_t i = 0; i < rows; ++i) {
+        uint64_t r = rng.next();
+        uint64_t tenths = r % 5000, cents = (r >> 20) % 100000;
+        starts.push_back(buf.size());
+        buf += to_string(tenths / 10) + "." + to_string(tenths % 10) + ",";
+        starts.push_back(buf.size());
+        buf += to_string(cents / 100) + "." + zpad((long long)(cents % 100), 2) + "\n";
+    }
+    starts.push_back(buf.size());
+    const size_t fields = starts.size() - 1;
+
+    long long fixedSum = 0, strtodSum = 0;
+    Summary fixed = summarize(repeat(reps, [&] {
+        long long sum = 0;
+        for (size_t i = 0; i < fields; ++i) {
+            int32_t v;
+            if (parse_hundredths(string_view(buf.data() + starts[i], starts[i + 1] - 1 - starts[i]), v)) sum += v;
+        }
+        fixedSum = sum;
+    }));
+    Summary viaStrtod = summarize(repeat(reps, [&] {
+        long long sum = 0;
+        for (size_t i = 0; i < fields; ++i) sum += llround(strtod(buf.data() + starts[i], nullptr) * 100.0);
+        strtodSum = sum;
+    }));
+
+    printf("PARSE values=%zu reps=%d %s\n", fields, reps, fixedSum == strtodSum ? "sums agree" : "SUMS DIFFER");
+    printf("  %-18s %10s %10s %10s %10s\n", "parser", "median_ms", "p95_ms", "ns/value", "Mvalues/s");
+    for (auto [name, t] : {pair<const char*, Summary>{"parse_hundredths", fixed}, {"strtod+llround", viaStrtod}}) {
+        printf("  %-18s %10.1f %10.1f %10.2f %10.1f\n", name, t.median * 1e3, t.p95 * 1e3,
+               t.median * 1e9 / (double)fields, (double)fields / t.median / 1e6);
+    }
+}
+
+// ---------------- INGEST / TOPK ----------------
+
+static void bench_ingest(const vector<Dataset>& sets, int reps, unsigned threads) {
+    printf("INGEST threads=%u reps=%d\n", threads, reps);
+    printf("  %-6s %10s %10s %10s %10s %10s %10s\n", "data", "rows", "MB", "median_ms", "p95_ms", "Mrows/s", "MB/s");
+    for (const Dataset& d : sets) {
+        Summary s = summarize(repeat(reps, [&] {
+            TripAnalyzer a;
+            a.setThreadCount(threads);
+            a.ingestFile(d.path.string());
+        }));
+        printf("  %-6s %10zu %10.1f %10.1f %10.1f %10.2f %10.1f\n", d.name.c_str(), d.rows, (double)d.bytes / 1e6,
+               s.median * 1e3, s.p95 * 1e3, (double)d.rows / s.median / 1e6, (double)d.bytes / s.median / 1e6);
+    }
+}
+
+// Calls per timed run are chosen so one run takes about 20 ms.
+template <class Fn>
+static Summary ns_per_call(int reps, Fn&& fn) {
+    size_t calls = 1;
+    for (;;) {
+        auto t0 = Clock::now();
+        for (size_t i = 0; i < calls; ++i) fn();
+        if (Clock::now() - t0 > chrono::milliseconds(20) || calls >= (1u << 24)) break;
+        calls *= 2;
+    }
+    vector<double> runs = repeat(reps, [&] {
+        for (size_t i = 0; i < calls; ++i) fn();
+    });
+    for (double& r : runs) r = r * 1e9 / (double)calls;
+    return summarize(runs);
+}
+
+static void bench_topk(const vector<Dataset>& sets, int reps, unsigned threads) {
+    printf("TOPK threads=%u reps=%d (ns per call)\n", threads, reps);
+    printf("  %-6s %6s %14s %14s %14s %14s\n", "data", "k", "zones_median", "zones_p95", "slots_median", "slots_p95");
+    for (const Dataset& d : sets) {
+        TripAnalyzer a;
+        a.setThreadCount(threads);
+        a.ingestFile(d.path.string());
+        for (int k : {1, 10, 100, 1000}) {
+            volatile size_t sink = 0;
+            Summary z = ns_per_call(reps, [&] { sink = sink + a.topZones(k).size(); });
+            Summary s = ns_per_call(reps, [&] { sink = sink + a.topBusySlots(k).size(); });
+            printf("  %-6s %6d %14.0f %14.0f %14.0f %14.0f\n", d.name.c_str(), k, z.median, z.p95, s.median, s.p95);
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    vector<string> want(argv + 1, argv + argc);
+    auto enabled = [&](const char* name) { return want.empty() || find(want.begin(), want.end(), name) != want.end(); };
+
+    const int reps = (int)max(1LL, env_ll("BENCH_REPS", 7));
+    const double scale = env_double("BENCH_SCALE", 1.0);
+    const unsigned threads = (unsigned)max(0LL, env_ll("BENCH_THREADS", 1));
+
+    if (enabled("split")) bench_split(reps);
+    if (enabled("table")) bench_table();
+    if (enabled("parse")) bench_parse(reps);
+
+    if (enabled("ingest") || enabled("topk")) {
+        fs::path dir = fs::temp_directory_path() / ("trip_bench_" + to_string(Clock::now().time_since_epoch().count()));
+        fs::create_directories(dir);
+        auto n = [&](double rows) { return (size_t)max(1.0, rows * scale); };
+        vector<Dataset> sets = {
+            make_c1(dir, n(150000)),
+            make_c2(dir, n(2000000)),
+            make_c3(dir, n(2500000), n(200000)),
+            make_zipf(dir, n(2000000), 100000, 1.1),
+        };
+        if (enabled("ingest")) bench_ingest(sets, reps, threads);
+        if (enabled("topk")) bench_topk(sets, reps, threads);
+        error_code ec;
+        fs::remove_all(dir, ec);
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include "csv_scan.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define CSV_HAVE_X86_SIMD 1
+#endif
+
+namespace csv {
+
+BlockMasks scan_block_scalar(const char* block) {
+    BlockMasks m{0, 0};
+    for (unsigned i = 0; i < 64; ++i) {
+        m.commas |= (uint64_t)(block[i] == ',') << i;
+        m.newlines |= (uint64_t)(block[i] == '\n') << i;
+    }
+    return m;
+}
+
+#ifdef CSV_HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static BlockMasks scan_block_sse2(const char* block) {
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i nl = _mm_set1_epi8('\n');
+    BlockMasks m{0, 0};
+    for (unsigned i = 0; i < 4; ++i) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+        uint64_t c = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, comma));
+        uint64_t n = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        m.commas |= c << (16 * i);
+        m.newlines |= n << (16 * i);
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+static BlockMasks scan_block_avx2(const char* block) {
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i nl = _mm256_set1_epi8('\n');
+    __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+    __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32));
+    uint64_t cl = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, comma));
+    uint64_t ch = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, comma));
+    uint64_t nlo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl));
+    uint64_t nhi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl));
+    return BlockMasks{cl | (ch << 32), nlo | (nhi << 32)};
+}
+
+#endif
+
+namespace {
+
+struct Selected {
+    BlockScanner fn;
+    const char* name;
+};
+
+Selected select_scanner() {
+#ifdef CSV_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {scan_block_avx2, "avx2"};
+    if (__builtin_cpu_supports("sse2")) return {scan_block_sse2, "sse2"};
+#endif
+    return {scan_block_scalar, "scalar"};
+}
+
+const Selected& selected() {
+    static const Selected s = select_scanner();
+    return s;
+}
+
+} // namespace
+
+BlockScanner active_scanner() { return selected().fn; }
+const char* active_scanner_name() { return selected().name; }
+
+} // namespace csv
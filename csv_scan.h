@@ -0,0 +1,145 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// Block-at-a-time delimiter scanning for the CSV ingest path.
+//
+// A scanner turns 64 input bytes into two bitmasks with bit i set when byte i
+// is ',' or '\n'. The SSE2 and AVX2 variants are picked once at runtime from
+// the CPU's features; other targets use the scalar loop. for_each_row() walks
+// the masks to cut the buffer into rows and record comma offsets in a fixed
+// array, so splitting never touches the heap. RowSplitter hands out the same
+// rows in caller-sized batches.
+namespace csv {
+
+struct BlockMasks {
+    uint64_t commas;
+    uint64_t newlines;
+};
+
+// Scans exactly 64 readable bytes starting at `block`.
+using BlockScanner = BlockMasks (*)(const char* block);
+
+BlockMasks scan_block_scalar(const char* block);
+
+// Fastest scanner supported by this CPU, and its name for reports.
+BlockScanner active_scanner();
+const char* active_scanner_name();
+
+// One line of input without its '\n', plus the offsets of its first
+// kMaxCommas commas. Fields past kMaxCommas - 1 are not addressable.
+struct Row {
+    static constexpr size_t kMaxCommas = 15;
+
+    std::string_view line;
+    size_t ncommas = 0;                          // total commas, may exceed kMaxCommas
+    std::array<uint32_t, kMaxCommas> commas{};   // offsets into line
+
+    // Field idx as [b, e) offsets into line; false when the row has no such field.
+    bool field(size_t idx, size_t& b, size_t& e) const {
+        if (idx == 0) {
+            b = 0;
+            e = ncommas == 0 ? line.size() : commas[0];
+            return true;
+        }
+        if (idx - 1 >= ncommas || idx >= kMaxCommas) return false;
+        b = commas[idx - 1] + 1;
+        e = idx < ncommas ? commas[idx] : line.size();
+        return true;
+    }
+};
+
+inline unsigned lowest_bit(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctzll(x);
+#else
+    unsigned n = 0;
+    while (!(x & 1)) { x >>= 1; ++n; }
+    return n;
+#endif
+}
+
+// Resumable form of the splitter: next() fills up to `max` rows and picks up
+// where the previous call stopped, so callers can work on batches of rows.
+// Rows follow getline semantics; empty lines come out as empty rows.
+class RowSplitter {
+public:
+    RowSplitter(const char* data, size_t size, BlockScanner scan = active_scanner())
+        : data(data), size(size), scan(scan) {}
+
+    // A call only returns after a completed row, so rows never straddle
+    // calls and are written straight into `out`.
+    size_t next(Row* out, size_t max) {
+        if (max == 0) return 0;
+        size_t n = 0;
+        Row* r = out;
+        r->ncommas = 0;
+        for (;;) {
+            if (bits == 0) {
+                if (base >= size) {
+                    if (rowStart < size) {
+                        r->line = std::string_view(data + rowStart, size - rowStart);
+                        ++n;
+                        rowStart = size;
+                    }
+                    break;
+                }
+                BlockMasks m = load(base);
+                bits = m.commas | m.newlines;
+                newlines = m.newlines;
+                blockBase = base;
+                base += 64;
+                continue;
+            }
+
+            unsigned i = lowest_bit(bits);
+            bits &= bits - 1;
+            size_t pos = blockBase + i;
+            if ((newlines >> i) & 1) {
+                r->line = std::string_view(data + rowStart, pos - rowStart);
+                rowStart = pos + 1;
+                if (++n == max) break;
+                r = out + n;
+                r->ncommas = 0;
+            } else {
+                if (r->ncommas < Row::kMaxCommas) r->commas[r->ncommas] = (uint32_t)(pos - rowStart);
+                ++r->ncommas;
+            }
+        }
+        return n;
+    }
+
+private:
+    BlockMasks load(size_t at) {
+        if (size - at >= 64) return scan(data + at);
+        char tail[64] = {};
+        std::memcpy(tail, data + at, size - at);
+        return scan(tail);
+    }
+
+    const char* data;
+    size_t size;
+    BlockScanner scan;
+    size_t base = 0;        // next block to load
+    size_t blockBase = 0;   // offset of the block `bits` came from
+    uint64_t bits = 0;      // delimiters of the current block not yet consumed
+    uint64_t newlines = 0;
+    size_t rowStart = 0;
+};
+
+// Calls fn(const Row&) for every '\n'-terminated line in [data, data+size) and
+// for a trailing line without '\n', matching getline. Empty lines are passed on
+// as empty rows.
+template <class Fn>
+void for_each_row(const char* data, size_t size, Fn&& fn, BlockScanner scan = active_scanner()) {
+    RowSplitter split(data, size, scan);
+    Row rows[64];
+    while (size_t n = split.next(rows, 64)) {
+        for (size_t i = 0; i < n; ++i) fn(static_cast<const Row&>(rows[i]));
+    }
+}
+
+} // namespace csv
@@ -0,0 +1,48 @@
+#pragma once
+#include <climits>
+#include <cstdint>
+#include <string_view>
+
+// Fixed-point parsing for the distance and fare columns.
+//
+// A field such as "16.0", " -3.25" or "+7" becomes an integer count of
+// hundredths, exact to the cent: digits are accumulated as integers and the
+// third fractional digit rounds half away from zero. Unlike strtod there is
+// no locale, no errno, no exponent syntax and no need for a terminating NUL,
+// so a field can be parsed in place inside the mapped file.
+//
+// Returns false for a blank field, any character outside
+// [ \t\r] [+-] digits [. digits] [ \t\r], or a magnitude past INT32_MAX
+// hundredths (21,474,836.47).
+inline bool parse_hundredths(std::string_view s, int32_t& out) {
+    const char* p = s.data();
+    const char* e = p + s.size();
+    while (p < e && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+    while (e > p && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) --e;
+    if (p == e) return false;
+
+    bool neg = *p == '-';
+    if (*p == '-' || *p == '+') ++p;
+
+    int64_t v = 0;
+    bool digits = false;
+    for (; p < e && (unsigned)(*p - '0') < 10; ++p) {
+        v = v * 10 + (*p - '0');
+        if (v > INT32_MAX / 100) return false;
+        digits = true;
+    }
+    v *= 100;
+    if (p < e && *p == '.') {
+        ++p;
+        for (int n = 0; p < e && (unsigned)(*p - '0') < 10; ++p, ++n) {
+            int d = *p - '0';
+            if (n == 0) v += d * 10;
+            else if (n == 1) v += d;
+            else if (n == 2 && d >= 5) v += 1;
+            digits = true;
+        }
+    }
+    if (p != e || !digits || v > INT32_MAX) return false;
+    out = (int32_t)(neg ? -v : v);
+    return true;
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+// Open-addressing hash index from short string keys to dense uint32_t ids.
+//
+// Slots hold only a cached 32-bit hash and the id (8 bytes each); the key
+// bytes stay with the owner, which passes a keyOf(id) accessor to find().
+// A probe compares the cached hash first and touches key bytes only on a hash
+// match. Linear probing over a power-of-two array kept at most half full, so
+// growth re-inserts cached hashes without rehashing any key.
+class FlatIndex {
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    // wyhash-style: fold each 8-byte word through a 64x64->128 multiply; the
+    // last 1..8 bytes are read as two overlapping 4-byte loads.
+    static uint32_t hash(std::string_view key) {
+        const char* p = key.data();
+        size_t n = key.size();
+        uint64_t h = 0x9E3779B97F4A7C15ull ^ (uint64_t)n;
+        while (n > 8) {
+            h = fold(h ^ load64(p), 0xA0761D6478BD642Full);
+            p += 8;
+            n -= 8;
+        }
+        uint64_t w = 0;
+        if (n >= 4) {
+            w = ((uint64_t)load32(p) << 32) | load32(p + n - 4);
+        } else if (n > 0) {
+            w = ((uint64_t)(unsigned char)p[0] << 16) | ((uint64_t)(unsigned char)p[n / 2] << 8) |
+                (unsigned char)p[n - 1];
+        }
+        h = fold(h ^ w, 0xE7037ED1A0B428DBull);
+        return (uint32_t)(h ^ (h >> 32));
+    }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return slots.size(); }
+    size_t rehashes() const { return regrows; }   // grows that moved existing slots
+
+    // Id stored for `key` (whose hash is h), or npos.
+    template <class KeyOf>
+    uint32_t find(std::string_view key, uint32_t h, const KeyOf& keyOf) const {
+        if (slots.empty()) return npos;
+        for (size_t i = h & mask;; i = (i + 1) & mask) {
+            const Slot& s = slots[i];
+            if (s.id == npos) return npos;
+            if (s.hash == h && keyOf(s.id) == key) return s.id;
+        }
+    }
+
+    // Add an id whose key is known to be absent.
+    void insert(uint32_t h, uint32_t id) {
+        if ((count + 1) * 2 > slots.size()) grow(slots.empty() ? 16 : slots.size() * 2);
+        place(h, id);
+        ++count;
+    }
+
+    // Remove an id stored under hash h. Later members of its probe run are
+    // shifted back into the hole, so lookups never need tombstones.
+    void erase(uint32_t h, uint32_t id) {
+        size_t hole = h & mask;
+        while (slots[hole].id != id) hole = (hole + 1) & mask;
+        for (size_t j = (hole + 1) & mask; slots[j].id != npos; j = (j + 1) & mask) {
+            size_t home = slots[j].hash & mask;
+            if (((j - home) & mask) >= ((j - hole) & mask)) {   // hole lies on j's probe path
+                slots[hole] = slots[j];
+                hole = j;
+            }
+        }
+        slots[hole] = Slot{0, npos};
+        --count;
+    }
+
+    // Size the table so n keys fit without growing.
+    void reserve(size_t n) {
+        size_t want = 16;
+        while (want < n * 2) want *= 2;
+        if (want > slots.size()) grow(want);
+    }
+
+    void clear() {
+        slots.clear();
+        mask = 0;
+        count = 0;
+        regrows = 0;
+    }
+
+private:
+    struct Slot {
+        uint32_t hash;
+        uint32_t id;    // npos marks an empty slot
+    };
+
+    static uint64_t load64(const char* p) {
+        uint64_t w;
+        std::memcpy(&w, p, 8);
+        return w;
+    }
+    static uint32_t load32(const char* p) {
+        uint32_t w;
+        std::memcpy(&w, p, 4);
+        return w;
+    }
+
+    static uint64_t fold(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+        __uint128_t r = (__uint128_t)a * b;
+        return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+        uint64_t x = a * b;
+        x ^= x >> 33;
+        x *= 0xFF51AFD7ED558CCDull;
+        return x ^ (x >> 33);
+#endif
+    }
+
+    void place(uint32_t h, uint32_t id) {
+        size_t i = h & mask;
+        while (slots[i].id != npos) i = (i + 1) & mask;
+        slots[i] = Slot{h, id};
+    }
+
+    void grow(size_t capacity) {
+        std::vector<Slot> old;
+        old.swap(slots);
+        if (count != 0) ++regrows;
+        slots.assign(capacity, Slot{0, npos});
+        mask = capacity - 1;
+        for (const Slot& s : old) {
+            if (s.id != npos) place(s.hash, s.id);
+        }
+    }
+
+    std::vector<Slot> slots;
+    size_t mask = 0;
+    size_t count = 0;
+    size_t regrows = 0;
+};
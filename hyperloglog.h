@@ -0,0 +1,47 @@
+#pragma once
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+// HyperLogLog distinct counter over 32-bit hashes, 2^12 one-byte registers
+// (4 KiB, about 1.6% standard error). The top 12 hash bits pick a register,
+// which keeps the longest run of leading zeros seen in the remaining 20 bits.
+class HyperLogLog {
+public:
+    static constexpr int kBits = 12;
+    static constexpr size_t kRegisters = size_t(1) << kBits;
+
+    void add(uint32_t hash) {
+        uint32_t reg = hash >> (32 - kBits);
+        uint32_t rest = (hash << kBits) | (1u << (kBits - 1));   // sentinel caps the run
+        uint8_t rank = (uint8_t)(leading_zeros(rest) + 1);
+        if (rank > registers[reg]) registers[reg] = rank;
+    }
+
+    double estimate() const {
+        const double m = (double)kRegisters;
+        double sum = 0.0;
+        size_t zeros = 0;
+        for (uint8_t r : registers) {
+            sum += std::ldexp(1.0, -(int)r);
+            zeros += (r == 0);
+        }
+        double e = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+        // Small-range correction: linear counting while registers are still empty.
+        if (e <= 2.5 * m && zeros != 0) e = m * std::log(m / (double)zeros);
+        return e;
+    }
+
+private:
+    static int leading_zeros(uint32_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_clz(x);
+#else
+        int n = 0;
+        while (!(x & 0x80000000u)) { x <<= 1; ++n; }
+        return n;
+#endif
+    }
+
+    std::array<uint8_t, kRegisters> registers{};
+};
@@ -0,0 +1,155 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// KLL quantile sketch over int32 values (Karnin, Lang and Liberty, 2016).
+//
+// Values sit in a stack of compactors; an item at level h stands for 2^h
+// inputs. Level h holds at most about kK * (2/3)^(top - h) items, so a
+// sketch never keeps more than about 3 * kK values however many it has seen.
+// As in the reference implementation all levels share one buffer, top level
+// first and level 0 last, whose capacity grows geometrically but never past
+// that budget: at most about 1.5 KiB at kK = 128 (heapBytes()), and a zone
+// with one fare keeps one int. When the total passes the budget the lowest
+// full level is sorted and every other item is promoted to the next level,
+// which ends where it begins. Which half survives alternates per level
+// instead of being drawn at random, so results are reproducible; a single
+// shared toggle would fall into step with the regular order in which levels
+// fill and keep promoting the same half.
+// Rank error stays near 1% at kK = 128. Sketches merge by concatenating
+// levels and compacting, so per-thread sketches combine after parallel ingest.
+class KllSketch {
+public:
+    static constexpr uint32_t kK = 128;
+
+    uint64_t count() const { return n; }
+    bool empty() const { return n == 0; }
+    size_t retained() const { return items.size(); }
+    size_t heapBytes() const { return items.capacity() * sizeof(int32_t) + first.capacity() * sizeof(uint32_t); }
+
+    void add(int32_t v) {
+        if (first.empty()) grow(1);
+        if (items.size() == items.capacity()) {
+            items.reserve(std::min(std::max<size_t>(1, 2 * items.size()), limit + 1));
+        }
+        items.push_back(v);   // level 0 is last
+        note(v, v, 1);
+        if (items.size() > limit) compress();
+    }
+
+    void merge(const KllSketch& o) {
+        if (o.n == 0) return;
+        if (first.size() < o.first.size()) grow(o.first.size());
+        std::vector<int32_t> joined;
+        joined.reserve(items.size() + o.items.size());
+        for (size_t h = first.size(); h-- > 0;) {
+            size_t start = joined.size();
+            joined.insert(joined.end(), items.begin() + (std::ptrdiff_t)first[h],
+                          items.begin() + (std::ptrdiff_t)end(h));
+            if (h < o.first.size()) {
+                joined.insert(joined.end(), o.items.begin() + (std::ptrdiff_t)o.first[h],
+                              o.items.begin() + (std::ptrdiff_t)o.end(h));
+            }
+            first[h] = (uint32_t)start;
+        }
+        items.swap(joined);
+        note(o.lo, o.hi, o.n);
+        while (items.size() > limit) compress();
+        items.shrink_to_fit();
+    }
+
+    // Smallest retained value whose weighted rank reaches q * count(); the
+    // exact minimum for q <= 0 and maximum for q >= 1. INT32_MIN when empty.
+    int32_t quantile(double q) const {
+        if (n == 0) return INT32_MIN;
+        if (q <= 0.0) return lo;
+        if (q >= 1.0) return hi;
+
+        std::vector<std::pair<int32_t, uint64_t>> weighted;
+        weighted.reserve(items.size());
+        for (size_t h = 0; h < first.size(); ++h) {
+            for (size_t i = first[h]; i < end(h); ++i) weighted.emplace_back(items[i], uint64_t(1) << h);
+        }
+        std::sort(weighted.begin(), weighted.end());
+
+        // Compaction turns two items of weight w into one of weight 2w, so the
+        // weights always sum to n.
+        double target = q * (double)n;
+        uint64_t rank = 0;
+        for (const auto& w : weighted) {
+            rank += w.second;
+            if ((double)rank >= target) return w.first;
+        }
+        return hi;
+    }
+
+private:
+    void note(int32_t vlo, int32_t vhi, uint64_t added) {
+        if (n == 0 || vlo < lo) lo = vlo;
+        if (n == 0 || vhi > hi) hi = vhi;
+        n += added;
+    }
+
+    // Level h is items[first[h], end(h)).
+    size_t end(size_t h) const { return h == 0 ? items.size() : first[h - 1]; }
+
+    // Items level h may hold before it is compacted.
+    size_t capacity(size_t h) const {
+        size_t depth = first.size() - 1 - h;   // 0 for the top level
+        double cap = kK;
+        for (size_t i = 0; i < depth && cap > 2.0; ++i) cap *= 2.0 / 3.0;
+        return std::max<size_t>(2, (size_t)cap);
+    }
+
+    // Add empty top levels up to `depth` and recompute the item budget,
+    // which only changes with the number of levels.
+    void grow(size_t depth) {
+        first.resize(depth, 0);   // the top level starts the buffer
+        limit = 0;
+        for (size_t h = 0; h < first.size(); ++h) limit += capacity(h);
+    }
+
+    // Compact the lowest level that is at capacity.
+    void compress() {
+        for (size_t h = 0; h < first.size(); ++h) {
+            if (end(h) - first[h] >= capacity(h)) {
+                compact(h);
+                return;
+            }
+        }
+    }
+
+    // Level h + 1 ends where level h begins, so the promoted half is written
+    // over the front of level h and the buffer closes up behind it.
+    void compact(size_t h) {
+        if (h + 1 == first.size()) grow(first.size() + 1);
+        size_t a = first[h], b = end(h);
+        std::sort(items.begin() + (std::ptrdiff_t)a, items.begin() + (std::ptrdiff_t)b);
+
+        // An odd item out stays behind at this level.
+        size_t pairs = (b - a) / 2;
+        bool odd = (b - a) % 2 != 0;
+        int32_t leftover = items[b - 1];
+        size_t offset = (flips >> h) & 1;
+        for (size_t i = 0; i < pairs; ++i) items[a + i] = items[a + 2 * i + offset];
+        flips ^= uint64_t(1) << h;
+
+        size_t keep = a + pairs;
+        if (odd) items[keep++] = leftover;
+        items.erase(items.begin() + (std::ptrdiff_t)keep, items.begin() + (std::ptrdiff_t)b);
+        first[h] = (uint32_t)(a + pairs);
+        for (size_t j = 0; j < h; ++j) first[j] -= (uint32_t)pairs;
+    }
+
+    std::vector<int32_t> items;     // every level, top first
+    std::vector<uint32_t> first;    // start of level h in items
+    uint64_t n = 0;
+    size_t limit = 0;   // sum of level capacities
+    int32_t lo = 0;
+    int32_t hi = 0;
+    uint64_t flips = 0;   // bit h: which half level h promotes next
+};
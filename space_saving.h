@@ -0,0 +1,206 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "flat_index.h"
+
+// Space-Saving heavy-hitter summary (Metwally, Agrawal and El Abbadi, 2005).
+//
+// At most capacity() counters are kept however many distinct keys stream
+// past. A tracked key is counted exactly from the moment it got its counter;
+// an untracked key takes over the counter with the smallest count and
+// inherits that count as its error, so every estimate is an overcount:
+// the true count lies in [count - error, count]. untrackedBound() bounds the
+// count of every key not tracked: the smallest count once the summary is
+// full (at most total() / capacity()), and never less than what merges
+// have let go. Any key seen more often than that is guaranteed a counter.
+//
+// Counters sit in a min-heap by count for O(log m) eviction and in a
+// FlatIndex for lookup, all allocated up front, so a summary never grows
+// past bytesFor(capacity()). Summaries merge (Agarwal et al., 2012): counts
+// add per key, a key missing from a full side is charged that side's
+// minimum, and the largest capacity() results are kept.
+class SpaceSaving {
+public:
+    struct Counter {
+        std::string key;
+        long long count;
+        long long error;
+        uint32_t hash;
+    };
+
+    // Heap bytes of a summary with `capacity` counters: the counters, their
+    // heap and position entries, and the index, whose power-of-two table
+    // holds between two and four slots per counter. Keys longer than the
+    // string's inline buffer add their length on top.
+    static size_t bytesFor(size_t capacity) {
+        size_t slots = 16;
+        while (slots < capacity * 2) slots *= 2;
+        return capacity * (sizeof(Counter) + 2 * sizeof(uint32_t)) + slots * 8;
+    }
+
+    // Largest capacity whose bytesFor() fits in `bytes`; 0 if none does.
+    static size_t capacityFor(size_t bytes) {
+        size_t lo = 0, hi = bytes / sizeof(Counter);
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo + 1) / 2;
+            if (bytesFor(mid) <= bytes) lo = mid;
+            else hi = mid - 1;
+        }
+        return lo;
+    }
+
+    explicit SpaceSaving(size_t capacity = 0) { setCapacity(capacity); }
+
+    // Drops every counter.
+    void setCapacity(size_t capacity) {
+        clear();
+        cap = capacity;
+        counters.reserve(cap);
+        heap.reserve(cap);
+        pos.reserve(cap);
+        index.reserve(cap);
+    }
+
+    size_t capacity() const { return cap; }
+    size_t size() const { return counters.size(); }
+    long long total() const { return seen; }
+    const std::vector<Counter>& entries() const { return counters; }
+
+    // Upper bound on the count of any key without a counter.
+    long long untrackedBound() const {
+        long long min = cap != 0 && counters.size() == cap ? counters[heap[0]].count : 0;
+        return std::max(mergedBound, min);
+    }
+
+    void add(std::string_view key, long long n = 1) {
+        seen += n;
+        if (cap == 0) return;
+        uint32_t h = FlatIndex::hash(key);
+        uint32_t id = index.find(key, h, keyOf());
+        if (id != FlatIndex::npos) {
+            counters[id].count += n;
+            siftDown(pos[id]);
+            return;
+        }
+        // The key may have been seen before, up to the bound, without a counter.
+        long long bound = untrackedBound();
+        if (counters.size() < cap) {
+            push(Counter{std::string(key), bound + n, bound, h});
+            return;
+        }
+        replaceMin(key, h, bound + n, bound);
+    }
+
+    // Merged in place: the union's counts are computed into this summary's
+    // counters, and keys only `o` tracks compete for them with the smallest,
+    // so merging needs no scratch beyond the two summaries. The kept
+    // counters are the capacity() largest of the union. A key neither side
+    // tracks may have been counted by both, so minSelf + minOther stays the
+    // least untrackedBound() even if this summary is left part-full (a
+    // smaller summary can have evicted keys that would fit here).
+    void merge(const SpaceSaving& o) {
+        seen += o.seen;
+        long long minSelf = untrackedBound();
+        long long minOther = o.untrackedBound();
+        mergedBound = minSelf + minOther;
+        if (o.counters.empty()) return;
+
+        for (Counter& c : counters) {
+            uint32_t j = o.index.find(c.key, c.hash, o.keyOf());
+            long long count = j != FlatIndex::npos ? o.counters[j].count : minOther;
+            long long error = j != FlatIndex::npos ? o.counters[j].error : minOther;
+            c.count += count;
+            c.error += error;
+        }
+        for (size_t i = heap.size() / 2; i-- > 0;) siftDown(i);
+
+        for (const Counter& c : o.counters) {
+            if (index.find(c.key, c.hash, keyOf()) != FlatIndex::npos) continue;
+            long long count = c.count + minSelf;
+            if (counters.size() < cap) {
+                push(Counter{c.key, count, c.error + minSelf, c.hash});
+            } else if (count > counters[heap[0]].count) {
+                replaceMin(c.key, c.hash, count, c.error + minSelf);
+            }
+        }
+    }
+
+    void clear() {
+        counters.clear();
+        heap.clear();
+        pos.clear();
+        index.clear();
+        seen = 0;
+        mergedBound = 0;
+    }
+
+private:
+    struct KeyOf {
+        const std::vector<Counter>* counters;
+        std::string_view operator()(uint32_t id) const { return (*counters)[id].key; }
+    };
+    KeyOf keyOf() const { return KeyOf{&counters}; }
+
+    // Give the smallest counter to `key`.
+    void replaceMin(std::string_view key, uint32_t h, long long count, long long error) {
+        uint32_t id = heap[0];
+        Counter& c = counters[id];
+        index.erase(c.hash, id);
+        c.key.assign(key.data(), key.size());
+        c.hash = h;
+        c.count = count;
+        c.error = error;
+        index.insert(h, id);
+        siftDown(0);
+    }
+
+    void push(Counter c) {
+        uint32_t id = (uint32_t)counters.size();
+        index.insert(c.hash, id);
+        counters.push_back(std::move(c));
+        pos.push_back((uint32_t)heap.size());
+        heap.push_back(id);
+        siftUp(heap.size() - 1);
+    }
+
+    bool less(uint32_t a, uint32_t b) const { return counters[a].count < counters[b].count; }
+
+    void swapAt(size_t i, size_t j) {
+        std::swap(heap[i], heap[j]);
+        pos[heap[i]] = (uint32_t)i;
+        pos[heap[j]] = (uint32_t)j;
+    }
+
+    void siftUp(size_t i) {
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            if (!less(heap[i], heap[parent])) break;
+            swapAt(i, parent);
+            i = parent;
+        }
+    }
+
+    void siftDown(size_t i) {
+        for (;;) {
+            size_t l = 2 * i + 1, r = l + 1, m = i;
+            if (l < heap.size() && less(heap[l], heap[m])) m = l;
+            if (r < heap.size() && less(heap[r], heap[m])) m = r;
+            if (m == i) return;
+            swapAt(i, m);
+            i = m;
+        }
+    }
+
+    std::vector<Counter> counters;
+    std::vector<uint32_t> heap;   // counter ids, min count on top
+    std::vector<uint32_t> pos;    // counter id -> heap position
+    FlatIndex index;
+    size_t cap = 0;
+    long long seen = 0;
+    long long mergedBound = 0;   // bound on untracked keys carried over from merges
+};
@@ -1,8 +1,13 @@
 #include "catch_amalgamated.hpp"
 #include "analyzer.h"
+#include "csv_scan.h"
+#include "fixed_decimal.h"
 
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
+#include <map>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <tuple>
@@ -322,3 +327,1202 @@ TEST_CASE_METHOD(TripsFixture,
     const long long limit = envMs("C3_LIMIT_MS", fastMode() ? 3500 : 9000);
     REQUIRE(ms < limit);
 }
+
+// =============================================================
+// CATEGORY D: Ingest engine extensions
+// =============================================================
+TEST_CASE_METHOD(TripsFixture, "D1 Mapped ingest: CRLF endings and missing final newline", "[D]") {
+    std::string csv =
+        "TripID,PickupZoneID,PickupTime\r\n"
+        "1,Z1,2024-01-01 10:30\r\n"
+        "\r\n"
+        "2,Z2,2024-01-01 11:05\r\n"
+        "3,Z1,2024-01-01 10:45";
+    writeTripsCsv(csv);
+
+    TripAnalyzer a;
+    REQUIRE_NOTHROW(a.ingestFile("Trips.csv"));
+
+    requireZonesEq(a.topZones(10), {{"Z1", 2}, {"Z2", 1}});
+    requireSlotsEq(a.topBusySlots(10), {{"Z1", 10, 2}, {"Z2", 11, 1}});
+}
+
+TEST_CASE_METHOD(TripsFixture, "D2 Missing file => no crash, empty results", "[D]") {
+    TripAnalyzer a;
+    REQUIRE_NOTHROW(a.ingestFile("DoesNotExist.csv"));
+    REQUIRE(a.topZones(10).empty());
+    REQUIRE(a.topBusySlots(10).empty());
+}
+
+TEST_CASE_METHOD(TripsFixture, "D3 Threaded ingest matches serial at 1, 2, 8 and N threads", "[D]") {
+    // C2-shaped input: few zones, many rows, every hour populated.
+    const int N = fastMode() ? 300000 : 2000000;
+
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    csv.reserve((size_t)N * 30);
+    for (int i = 0; i < N; i++) {
+        int z = (i * 7) % 13;
+        int h = (i / 3) % 24;
+        csv += std::to_string(i + 1);
+        csv += ",Z";
+        csv += std::to_string(z);
+        csv += ",2024-01-01 ";
+        if (h < 10) csv += "0";
+        csv += std::to_string(h);
+        csv += ":00\n";
+    }
+    writeTripsCsv(csv);
+
+    TripAnalyzer serial;
+    serial.ingestFile("Trips.csv");
+    const auto expZones = serial.topZones(1000);
+    const auto expSlots = serial.topBusySlots(1000);
+    REQUIRE(expZones.size() == 13);
+    REQUIRE(expSlots.size() == 13 * 24);
+
+    for (unsigned t : {1u, 2u, 8u, 0u}) {
+        INFO("threads=" << t);
+        TripAnalyzer a;
+        a.setThreadCount(t);
+        a.ingestFile("Trips.csv");
+
+        const auto zones = a.topZones(1000);
+        REQUIRE(zones.size() == expZones.size());
+        for (size_t i = 0; i < zones.size(); i++) {
+            REQUIRE(zones[i].zone == expZones[i].zone);
+            REQUIRE(zones[i].count == expZones[i].count);
+        }
+        const auto slots = a.topBusySlots(1000);
+        REQUIRE(slots.size() == expSlots.size());
+        for (size_t i = 0; i < slots.size(); i++) {
+            REQUIRE(slots[i].zone == expSlots[i].zone);
+            REQUIRE(slots[i].hour == expSlots[i].hour);
+            REQUIRE(slots[i].count == expSlots[i].count);
+        }
+
+        // Small k is answered from the top-K index, which merging must keep exact.
+        const auto top = a.topBusySlots(5);
+        REQUIRE(top.size() == 5);
+        for (size_t i = 0; i < top.size(); i++) {
+            REQUIRE(top[i].zone == expSlots[i].zone);
+            REQUIRE(top[i].hour == expSlots[i].hour);
+        }
+        REQUIRE(a.topZones(3)[2].zone == expZones[2].zone);
+    }
+}
+
+TEST_CASE_METHOD(TripsFixture, "D4 Copied analyzer keeps its own zone dictionary", "[D]") {
+    writeTripsCsv("TripID,PickupZoneID,PickupTime\n"
+                  "1,Z1,2024-01-01 10:30\n"
+                  "2,Z2,2024-01-01 11:05\n"
+                  "3,Z1,2024-01-01 12:45\n");
+
+    TripAnalyzer copy;
+    {
+        TripAnalyzer a;
+        a.ingestFile("Trips.csv");
+        copy = a;
+    }
+    requireZonesEq(copy.topZones(10), {{"Z1", 2}, {"Z2", 1}});
+    requireSlotsEq(copy.topBusySlots(1), {{"Z1", 10, 1}});
+}
+
+TEST_CASE("D5 Block splitter: SIMD and scalar scanners agree across block edges", "[D]") {
+    // Rows of growing length so delimiters land on every offset of a 64-byte
+    // block, including rows longer than a block and more than kMaxCommas fields.
+    std::string buf;
+    for (int i = 0; i < 200; i++) {
+        buf += std::to_string(i);
+        for (int f = 0; f < i % 20; f++) buf += "," + std::string((size_t)(i % 7), 'x');
+        buf += "\n";
+        if (i % 13 == 0) buf += "\n";
+    }
+    buf += "tail,without,newline";
+
+    auto collect = [&](csv::BlockScanner scan) {
+        std::vector<std::vector<size_t>> rows;
+        csv::for_each_row(buf.data(), buf.size(), [&](const csv::Row& row) {
+            std::vector<size_t> f{row.line.size(), row.ncommas};
+            size_t b = 0, e = 0;
+            for (size_t i = 0; row.field(i, b, e); i++) {
+                f.push_back(b);
+                f.push_back(e);
+            }
+            rows.push_back(f);
+        }, scan);
+        return rows;
+    };
+
+    const auto scalar = collect(csv::scan_block_scalar);
+    REQUIRE(scalar.size() == 200 + 16 + 1);
+    REQUIRE(collect(csv::active_scanner()) == scalar);
+
+    // Field boundaries agree with a plain split of the final row.
+    REQUIRE(scalar.back() == std::vector<size_t>{20, 2, 0, 4, 5, 12, 13, 20});
+}
+
+TEST_CASE_METHOD(TripsFixture, "D6 Canonical timestamps take the fast path, others fall back", "[D]") {
+    std::string csv =
+        "TripID,PickupZoneID,PickupTime\n"
+        "1,Z1,2024-01-01 10:30\n"        // canonical
+        "2,Z1, 2024-01-01 10:45 \n"      // canonical after trimming
+        "3,Z1,24-01-01 07:05\n"           // two-digit year: slow path
+        "4,Z1,2024-01-01 10:30:15\n"     // seconds: slow path
+        "5,Z2,2024-01-01 24:00\n"        // bad hour on both paths
+        "6,Z2,2024-01-01 23:60\n"        // bad minute on both paths
+        "7,Z2,2024/01/01 23:15\n"        // other date separators: slow path
+        "8,Z2,2024-01-01T23:15\n";       // no space: rejected
+    writeTripsCsv(csv);
+
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+
+    requireZonesEq(a.topZones(10), {{"Z1", 4}, {"Z2", 1}});
+    requireSlotsEq(a.topBusySlots(10), {{"Z1", 10, 3}, {"Z1", 7, 1}, {"Z2", 23, 1}});
+    REQUIRE(a.slowPathRows() == 3);
+}
+
+TEST_CASE_METHOD(TripsFixture, "D7 Schema is detected once from the header or the first rows", "[D]") {
+    SECTION("3-column header") {
+        writeTripsCsv("TripID,PickupZoneID,PickupTime\n"
+                      "1,Z1,2024-01-01 10:30\n");
+        TripAnalyzer a;
+        a.ingestFile("Trips.csv");
+        REQUIRE(a.schema().zoneColumn == 1);
+        REQUIRE(a.schema().timeColumn == 2);
+        REQUIRE_FALSE(a.schema().probeTime);
+        requireSlotsEq(a.topBusySlots(10), {{"Z1", 10, 1}});
+    }
+    SECTION("6-column header") {
+        writeTripsCsv("TripID,PickupZoneID,DropoffZoneID,PickupTime,Distance,Fare\n"
+                      "1,Z1,Z9,2024-01-01 10:30,1.5,7.0\n");
+        TripAnalyzer a;
+        a.ingestFile("Trips.csv");
+        REQUIRE(a.schema().zoneColumn == 1);
+        REQUIRE(a.schema().timeColumn == 3);
+        REQUIRE_FALSE(a.schema().probeTime);
+        requireSlotsEq(a.topBusySlots(10), {{"Z1", 10, 1}});
+    }
+    SECTION("headerless 6-column rows, like SmallTrips.csv") {
+        writeTripsCsv("1,Z1,Z9,2024-01-01 10:30,1.5,7.0\n"
+                      "2,Z2,Z9,2024-01-01 11:30,1.5,7.0\n");
+        TripAnalyzer a;
+        a.ingestFile("Trips.csv");
+        REQUIRE(a.schema().timeColumn == 3);
+        REQUIRE_FALSE(a.schema().probeTime);
+        requireZonesEq(a.topZones(10), {{"Z1", 1}, {"Z2", 1}});
+    }
+    SECTION("no parsable rows keep per-row probing") {
+        writeTripsCsv("TripID,Something\nBAD,LINE\n");
+        TripAnalyzer a;
+        a.ingestFile("Trips.csv");
+        REQUIRE(a.schema().probeTime);
+        REQUIRE(a.topZones(10).empty());
+    }
+    SECTION("locked layout still accepts a stray row in the other layout") {
+        writeTripsCsv("1,Z1,Z9,2024-01-01 10:30,1.5,7.0\n"
+                      "2,Z1,2024-01-01 11:30,1.5,7.0\n"
+                      "3,Z2,Z9,2024-01-01 11:45,1.5,7.0\n");
+        TripAnalyzer a;
+        a.ingestFile("Trips.csv");
+        REQUIRE(a.schema().timeColumn == 3);
+        requireZonesEq(a.topZones(10), {{"Z1", 2}, {"Z2", 1}});
+    }
+    SECTION("mixed-schema mode skips detection") {
+        writeTripsCsv("TripID,PickupZoneID,PickupTime\n"
+                      "1,Z1,2024-01-01 10:30\n"
+                      "2,Z1,Z9,2024-01-01 11:30,1.5,7.0\n");
+        TripAnalyzer a;
+        a.setMixedSchema(true);
+        a.ingestFile("Trips.csv");
+        REQUIRE(a.schema().probeTime);
+        requireZonesEq(a.topZones(10), {{"Z1", 2}});
+    }
+}
+
+TEST_CASE_METHOD(TripsFixture, "D8 Append accumulates across files; reset and ingestFile replace", "[D]") {
+    const std::string header = "TripID,PickupZoneID,PickupTime\n";
+    writeTripsCsv(header + "1,Z1,2024-01-01 10:30\n2,Z2,2024-01-01 10:45\n");
+
+    TripAnalyzer a;
+    a.appendFile("Trips.csv");
+    a.appendFile("Trips.csv");
+    const std::string chunk = header + "3,Z2,2024-01-01 11:00\n";
+    a.appendBuffer(chunk.data(), chunk.size());
+
+    requireZonesEq(a.topZones(10), {{"Z2", 3}, {"Z1", 2}});
+    requireSlotsEq(a.topBusySlots(10), {{"Z1", 10, 2}, {"Z2", 10, 2}, {"Z2", 11, 1}});
+
+    a.ingestFile("Trips.csv");
+    requireZonesEq(a.topZones(10), {{"Z1", 1}, {"Z2", 1}});
+
+    a.reset();
+    REQUIRE(a.topZones(10).empty());
+    REQUIRE(a.topBusySlots(10).empty());
+}
+
+TEST_CASE_METHOD(TripsFixture, "D9 Top-K index agrees with a full scan while appending", "[D]") {
+    // Skewed, shifting counts so index membership changes between appends.
+    TripAnalyzer indexed;
+    indexed.setTopKCapacity(8);
+    TripAnalyzer scanned;
+    scanned.setTopKCapacity(0);
+
+    for (int round = 0; round < 6; round++) {
+        std::string csv = "TripID,PickupZoneID,PickupTime\n";
+        for (int i = 0; i < 3000; i++) {
+            int z = (i * (round + 3)) % (40 + round * 17) % (5 + round * 9);
+            int h = (i + round) % 24;
+            csv += std::to_string(i) + ",Z" + zpad(z, 3) + ",2024-01-01 " + zpad(h, 2) + ":00\n";
+        }
+        indexed.appendBuffer(csv.data(), csv.size());
+        scanned.appendBuffer(csv.data(), csv.size());
+
+        for (int k : {1, 5, 8}) {
+            INFO("round=" << round << " k=" << k);
+            auto gz = indexed.topZones(k), ez = scanned.topZones(k);
+            REQUIRE(gz.size() == ez.size());
+            for (size_t i = 0; i < ez.size(); i++) {
+                REQUIRE(gz[i].zone == ez[i].zone);
+                REQUIRE(gz[i].count == ez[i].count);
+            }
+            auto gs = indexed.topBusySlots(k), es = scanned.topBusySlots(k);
+            REQUIRE(gs.size() == es.size());
+            for (size_t i = 0; i < es.size(); i++) {
+                REQUIRE(gs[i].zone == es[i].zone);
+                REQUIRE(gs[i].hour == es[i].hour);
+                REQUIRE(gs[i].count == es[i].count);
+            }
+        }
+    }
+
+    // Re-seeding at a new capacity keeps answers identical.
+    indexed.setTopKCapacity(3);
+    auto gz = indexed.topZones(3), ez = scanned.topZones(3);
+    for (size_t i = 0; i < ez.size(); i++) REQUIRE(gz[i].zone == ez[i].zone);
+
+    SECTION("merging a worker's tables keeps the slot index exact") {
+        // Two worker ranges. The first fills a 32-slot index with
+        // 31 count-6 slots and Z@05 at 5, the weakest member. The second lifts
+        // Z@05 to 15 and adds Z@03 with 7, which must displace a count-6 slot
+        // even though both Z counts grow in the same merge.
+        std::string first = "TripID,PickupZoneID,PickupTime\n";
+        for (int rep = 0; rep < 6; rep++) {
+            for (int slot = 0; slot < 31; slot++) {
+                const char* zone = slot < 24 ? "A" : "B";
+                first += std::string("1,") + zone + ",2024-01-01 " + zpad(slot % 24, 2) + ":00\n";
+            }
+        }
+        for (int i = 0; i < 5; i++) first += "1,Z,2024-01-01 05:00\n";
+        std::string second;
+        for (int i = 0; i < 10; i++) second += "2,Z,2024-01-01 05:00\n";
+        for (int i = 0; i < 7; i++) second += "2,Z,2024-01-01 03:00\n";
+
+        // Rejected padding puts each half in its own worker range; the split
+        // point lands on the second half's leading padding line.
+        const size_t half = (size_t)1 << 20;
+        std::string pad(99, 'x');
+        pad += "\n";
+        while (first.size() < half + 100) first += pad;
+        std::string csv = first;
+        while (csv.size() < 2 * first.size() - second.size()) csv += pad;
+        csv += second;
+
+        TripAnalyzer serial;
+        serial.setTopKCapacity(0);
+        serial.ingestBuffer(csv.data(), csv.size());
+        requireSlotsEq(serial.topBusySlots(2), {{"Z", 5, 15}, {"Z", 3, 7}});
+
+        TripAnalyzer threaded;
+        threaded.setTopKCapacity(32);
+        threaded.setThreadCount(2);
+        threaded.ingestBuffer(csv.data(), csv.size());
+        requireSlotsEq(threaded.topBusySlots(2), {{"Z", 5, 15}, {"Z", 3, 7}});
+        for (int k : {1, 8, 32}) {
+            INFO("k=" << k);
+            auto gs = threaded.topBusySlots(k), es = serial.topBusySlots(k);
+            REQUIRE(gs.size() == es.size());
+            for (size_t i = 0; i < es.size(); i++) {
+                REQUIRE(gs[i].zone == es[i].zone);
+                REQUIRE(gs[i].hour == es[i].hour);
+                REQUIRE(gs[i].count == es[i].count);
+            }
+        }
+    }
+}
+
+TEST_CASE_METHOD(TripsFixture, "D10 Buffer and stream ingest match file ingest", "[D]") {
+    // Larger than one stream block so lines straddle block boundaries.
+    std::string csv = "TripID,PickupZoneID,DropoffZoneID,PickupTime,Distance,Fare\n";
+    for (int i = 0; i < 150000; i++) {
+        csv += std::to_string(i) + ",Z" + zpad(i % 97, 2) + ",D1,2024-01-01 " + zpad((i / 7) % 24, 2) + ":" +
+               zpad(i % 60, 2) + ",1.0,2.0\n";
+    }
+    csv += "BAD,LINE";
+    REQUIRE(csv.size() > (5u << 20));
+    writeTripsCsv(csv);
+
+    TripAnalyzer file;
+    file.ingestFile("Trips.csv");
+    const auto expZones = file.topZones(200);
+    const auto expSlots = file.topBusySlots(5000);
+    REQUIRE(expZones.size() == 97);
+
+    TripAnalyzer buffer;
+    buffer.ingestBuffer(csv.data(), csv.size());
+
+    TripAnalyzer stream;
+    std::istringstream in(csv);
+    stream.ingestStream(in);
+
+    for (TripAnalyzer* a : {&buffer, &stream}) {
+        REQUIRE(a->schema().timeColumn == 3);
+        const auto zones = a->topZones(200);
+        REQUIRE(zones.size() == expZones.size());
+        for (size_t i = 0; i < zones.size(); i++) {
+            REQUIRE(zones[i].zone == expZones[i].zone);
+            REQUIRE(zones[i].count == expZones[i].count);
+        }
+        const auto slots = a->topBusySlots(5000);
+        REQUIRE(slots.size() == expSlots.size());
+        for (size_t i = 0; i < slots.size(); i++) {
+            REQUIRE(slots[i].zone == expSlots[i].zone);
+            REQUIRE(slots[i].hour == expSlots[i].hour);
+            REQUIRE(slots[i].count == expSlots[i].count);
+        }
+    }
+
+    std::istringstream empty("");
+    REQUIRE_NOTHROW(stream.ingestStream(empty));
+    REQUIRE(stream.topZones(10).empty());
+}
+
+TEST_CASE("D11 Zone dictionary keeps ids stable across table growth", "[D]") {
+    ZoneDictionary dict;
+    const int N = 100000;
+    for (int i = 0; i < N; i++) REQUIRE(dict.intern("Z" + std::to_string(i)) == (uint32_t)i);
+    REQUIRE(dict.size() == (size_t)N);
+
+    // Hits return the first-seen id and never add entries, including for
+    // keys that differ only in case or length.
+    for (int i = 0; i < N; i += 7) REQUIRE(dict.intern("Z" + std::to_string(i)) == (uint32_t)i);
+    REQUIRE(dict.intern("z1") == (uint32_t)N);
+    REQUIRE(dict.intern("Z1 ") == (uint32_t)N + 1);
+    REQUIRE(dict.intern("") == (uint32_t)N + 2);
+    REQUIRE(dict.intern("") == (uint32_t)N + 2);
+    REQUIRE(dict.name(12345) == "Z12345");
+
+    ZoneDictionary copy = dict;
+    dict.clear();
+    REQUIRE(copy.intern("Z99999") == 99999u);
+    REQUIRE(dict.intern("Z99999") == 0u);
+}
+
+TEST_CASE_METHOD(TripsFixture, "D12 Pre-sizing estimates rows and zones and avoids rehashes", "[D]") {
+    SECTION("high cardinality, C1-shaped") {
+        const int N = 150000;
+        std::string csv = "TripID,PickupZoneID,PickupTime\n";
+        for (int i = 0; i < N; i++) csv += std::to_string(i + 1) + ",Z" + zpad(i, 6) + ",2024-01-01 01:00\n";
+        writeTripsCsv(csv);
+
+        TripAnalyzer a;
+        a.setPresize(true);
+        a.ingestFile("Trips.csv");
+        const IngestStats& s = a.stats();
+        REQUIRE(s.estimatedRows > N * 95 / 100);
+        REQUIRE(s.estimatedRows < N * 105 / 100);
+        REQUIRE(s.estimatedZones > N * 85 / 100);
+        REQUIRE(s.estimatedZones < N * 115 / 100);
+        REQUIRE(s.rehashesAvoided > 0);
+        REQUIRE(a.topZones(1)[0].zone == "Z000000");
+    }
+    SECTION("few zones, many rows, C2-shaped") {
+        const int N = 400000;
+        std::string csv = "TripID,PickupZoneID,PickupTime\n";
+        for (int i = 0; i < N; i++) csv += std::to_string(i + 1) + ",Z" + std::to_string(i & 3) + ",2024-01-01 10:00\n";
+        writeTripsCsv(csv);
+
+        TripAnalyzer a;
+        a.setPresize(true);
+        a.ingestFile("Trips.csv");
+        REQUIRE(a.stats().estimatedRows > N * 95 / 100);
+        REQUIRE(a.stats().estimatedRows < N * 105 / 100);
+        REQUIRE(a.stats().estimatedZones <= 8);
+        requireZonesEq(a.topZones(1), {{"Z0", N / 4}});
+    }
+}
+
+TEST_CASE_METHOD(TripsFixture, "D13 Ingest stats count rows per rejection reason", "[D]") {
+    std::string csv =
+        "TripID,PickupZoneID,PickupTime\n"
+        "1,Z1,2024-01-01 10:30\n"
+        "BAD,LINE\n"                  // no time field
+        "2,Z1,2024-01-01 10:45\n"
+        "3,Z2,NOT_A_TIME\n"           // bad time
+        "4,,2024-01-01 11:00\n"       // blank zone
+        "\n"                          // empty line
+        "5,Z9,\n"                     // empty time
+        "6,Z2,2024-01-01 25:05\n"     // bad hour
+        "7,Z2,2024-01-01 11:5\n"      // bad minute
+        "8,Z2,2024-01-01 11:05\n";
+    writeTripsCsv(csv);
+
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+    const IngestStats& s = a.stats();
+
+    REQUIRE(s.bytesRead == (long long)csv.size());
+    REQUIRE(s.rowsSeen == 10);
+    REQUIRE(s.rowsAccepted == 3);
+    REQUIRE(s.rejectedMissingZone == 2);
+    REQUIRE(s.rejectedBadTime == 3);
+    REQUIRE(s.rejectedBadHour == 1);
+    REQUIRE(s.rejectedBadMinute == 1);
+    REQUIRE(s.rowsSeen == s.rowsAccepted + s.rowsRejected());
+    REQUIRE(s.distinctZones == 2);
+    REQUIRE(s.splitNs > 0);
+    REQUIRE(s.parseNs >= 0);
+    REQUIRE(s.aggregateNs >= 0);
+
+    // Appends accumulate; reset clears.
+    a.appendFile("Trips.csv");
+    REQUIRE(a.stats().rowsSeen == 20);
+    REQUIRE(a.stats().rowsAccepted == 6);
+    a.reset();
+    REQUIRE(a.stats().rowsSeen == 0);
+    REQUIRE(a.stats().bytesRead == 0);
+}
+
+TEST_CASE_METHOD(TripsFixture, "D14 Retained rows form a columnar store in input order", "[D]") {
+    SECTION("6-column header, with a 3-column straggler") {
+        std::string csv =
+            "TripID,PickupZoneID,DropoffZoneID,PickupTime,Distance,Fare\n"
+            "1,Z1,D9,2024-03-02 10:30,16.0,74.9\n"
+            "2,Z2,Z1,2024-03-02 23:59, 2.345 ,-1.5\n"
+            "BAD,LINE\n"
+            "3,Z1,2024-03-03 00:05\n"
+            "4,Z3,,1970-01-01 01:02,x,\n";
+        TripAnalyzer a;
+        a.setRetainRows(true);
+        a.ingestBuffer(csv.data(), csv.size());
+        REQUIRE(a.schema().dropoffColumn == 2);
+        REQUIRE(a.schema().fareColumn == 5);
+
+        const TripColumns& r = a.rows();
+        REQUIRE(r.size() == 4);
+        REQUIRE(a.zoneName(r.pickup[0]) == "Z1");
+        REQUIRE(a.zoneName(r.dropoff[0]) == "D9");
+        REQUIRE(r.pickup[1] == a.zoneId("Z2"));
+        REQUIRE(r.dropoff[1] == a.zoneId("Z1"));
+        REQUIRE(r.dropoff[2] == TripColumns::kNoZone);
+        REQUIRE(r.dropoff[3] == TripColumns::kNoZone);
+
+        const int32_t day = 19784;   // 2024-03-02
+        REQUIRE(r.minutes[0] == day * 1440 + 10 * 60 + 30);
+        REQUIRE(r.minutes[2] == (day + 1) * 1440 + 5);
+        REQUIRE(r.minutes[3] == 62);
+        REQUIRE(r.hour[1] == 23);
+
+        REQUIRE(r.distance[0] == 1600);
+        REQUIRE(r.fare[0] == 7490);
+        REQUIRE(r.distance[1] == 235);
+        REQUIRE(r.fare[1] == -150);
+        REQUIRE(r.fare[2] == TripColumns::kNoValue);
+        REQUIRE(r.distance[3] == TripColumns::kNoValue);
+        REQUIRE(r.fare[3] == TripColumns::kNoValue);
+
+        // Dropoff-only zones are interned but never ranked as pickups.
+        REQUIRE(a.zoneId("D9") != TripColumns::kNoZone);
+        REQUIRE(a.zoneId("D8") == TripColumns::kNoZone);
+        requireZonesEq(a.topZones(10), {{"Z1", 2}, {"Z2", 1}, {"Z3", 1}});
+        REQUIRE(a.stats().distinctZones == 3);
+
+        a.reset();
+        REQUIRE(a.rows().empty());
+    }
+    SECTION("threaded ingest keeps file order") {
+        std::string csv;
+        for (int i = 0; i < 120000; i++) {
+            csv += std::to_string(i) + ",P" + std::to_string(i % 501) + ",D" + std::to_string(i % 37) +
+                   ",2024-01-01 " + zpad(i % 24, 2) + ":" + zpad(i % 60, 2) + "," + std::to_string(i % 100) +
+                   ".5," + std::to_string(i) + ".25\n";
+        }
+        REQUIRE(csv.size() > (4u << 20));
+        writeTripsCsv(csv);
+
+        TripAnalyzer a;
+        a.setRetainRows(true);
+        a.setThreadCount(4);
+        a.ingestFile("Trips.csv");
+        const TripColumns& r = a.rows();
+        REQUIRE(r.size() == 120000);
+        for (int i = 0; i < 120000; i += 997) {
+            REQUIRE(a.zoneName(r.pickup[i]) == "P" + std::to_string(i % 501));
+            REQUIRE(a.zoneName(r.dropoff[i]) == "D" + std::to_string(i % 37));
+            REQUIRE(r.fare[i] == i * 100 + 25);
+            REQUIRE(r.distance[i] == (i % 100) * 100 + 50);
+            REQUIRE(r.minutes[i] == 19723 * 1440 + (i % 24) * 60 + i % 60);
+        }
+        REQUIRE(a.topZones(1000).size() == 501);
+
+        TripAnalyzer plain;
+        plain.ingestFile("Trips.csv");
+        REQUIRE(plain.rows().empty());
+        REQUIRE(plain.topZones(1)[0].zone == a.topZones(1)[0].zone);
+    }
+}
+
+TEST_CASE_METHOD(TripsFixture, "D15 Snapshot round-trips counts without re-parsing", "[D]") {
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    for (int i = 0; i < 20000; i++) {
+        csv += std::to_string(i) + ",Z" + std::to_string((i * 31) % 1777) + ",2024-01-01 " + zpad((i / 5) % 24, 2) +
+               ":00\n";
+    }
+    writeTripsCsv(csv);
+
+    TripAnalyzer src;
+    src.ingestFile("Trips.csv");
+    REQUIRE(src.saveSnapshot("trips.snap"));
+
+    TripAnalyzer dst;
+    dst.ingestBuffer("1,OLD,2024-01-01 01:00\n", 23);
+    REQUIRE(dst.loadSnapshot("trips.snap"));
+    REQUIRE(dst.stats().distinctZones == 1777);
+    REQUIRE(dst.zoneId("OLD") == TripColumns::kNoZone);
+
+    const auto expZones = src.topZones(5000);
+    const auto zones = dst.topZones(5000);
+    REQUIRE(zones.size() == expZones.size());
+    for (size_t i = 0; i < zones.size(); i++) {
+        REQUIRE(zones[i].zone == expZones[i].zone);
+        REQUIRE(zones[i].count == expZones[i].count);
+    }
+    const auto expSlots = src.topBusySlots(50000);
+    const auto slots = dst.topBusySlots(50000);
+    REQUIRE(slots.size() == expSlots.size());
+    for (size_t i = 0; i < slots.size(); i++) {
+        REQUIRE(slots[i].zone == expSlots[i].zone);
+        REQUIRE(slots[i].hour == expSlots[i].hour);
+        REQUIRE(slots[i].count == expSlots[i].count);
+    }
+    // The top-K index is rebuilt, and later appends add to the loaded counts.
+    REQUIRE(dst.topBusySlots(3)[0].zone == expSlots[0].zone);
+    dst.appendFile("Trips.csv");
+    REQUIRE(dst.topZones(1)[0].count == 2 * expZones[0].count);
+
+    SECTION("empty analyzer") {
+        TripAnalyzer empty, back;
+        REQUIRE(empty.saveSnapshot("empty.snap"));
+        REQUIRE(back.loadSnapshot("empty.snap"));
+        REQUIRE(back.topZones(10).empty());
+    }
+    SECTION("bad files are rejected and leave counts alone") {
+        std::string bytes;
+        {
+            std::ifstream in("trips.snap", std::ios::binary);
+            bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        std::ofstream("truncated.snap", std::ios::binary) << bytes.substr(0, bytes.size() - 1);
+        bytes[8] = 99;   // version
+        std::ofstream("version.snap", std::ios::binary) << bytes;
+
+        TripAnalyzer a;
+        a.ingestFile("Trips.csv");
+        REQUIRE_FALSE(a.loadSnapshot("truncated.snap"));
+        REQUIRE_FALSE(a.loadSnapshot("version.snap"));
+        REQUIRE_FALSE(a.loadSnapshot("Trips.csv"));
+        REQUIRE_FALSE(a.loadSnapshot("missing.snap"));
+        REQUIRE_FALSE(a.saveSnapshot("no_such_dir/x.snap"));
+        REQUIRE(a.topZones(1)[0].zone == expZones[0].zone);
+        REQUIRE(a.topZones(1)[0].count == expZones[0].count);
+    }
+}
+
+TEST_CASE("D16 Sharded top-K selection matches the serial scan, ties included", "[D]") {
+    // Enough zones for four 64K-zone shards; counts 1-3 so ties cross shards.
+    const int Z = 270000;
+    std::string csv;
+    for (int i = 0; i < Z; i++) {
+        int reps = 1 + (i % 7 == 0) + (i % 11 == 0);
+        for (int r = 0; r < reps; r++) {
+            csv += "1,Z" + std::to_string((i * 7919) % Z) + ",2024-01-01 " + zpad((i + r * 5) % 24, 2) + ":00\n";
+        }
+    }
+
+    TripAnalyzer serial;
+    serial.setTopKCapacity(0);
+    serial.ingestBuffer(csv.data(), csv.size());
+    TripAnalyzer sharded = serial;
+    sharded.setThreadCount(4);
+
+    for (int k : {1, 50, 5000, Z + 10}) {
+        INFO("k=" << k);
+        const auto expZones = serial.topZones(k);
+        const auto zones = sharded.topZones(k);
+        REQUIRE(zones.size() == expZones.size());
+        for (size_t i = 0; i < zones.size(); i++) {
+            REQUIRE(zones[i].zone == expZones[i].zone);
+            REQUIRE(zones[i].count == expZones[i].count);
+        }
+        const auto expSlots = serial.topBusySlots(k);
+        const auto slots = sharded.topBusySlots(k);
+        REQUIRE(slots.size() == expSlots.size());
+        for (size_t i = 0; i < slots.size(); i++) {
+            REQUIRE(slots[i].zone == expSlots[i].zone);
+            REQUIRE(slots[i].hour == expSlots[i].hour);
+            REQUIRE(slots[i].count == expSlots[i].count);
+        }
+    }
+    REQUIRE(sharded.topZones(1)[0].count == 3);
+}
+
+TEST_CASE("D17 Ranking by zone id breaks ties on name bytes like std::string", "[D]") {
+    // Prefixes, punctuation and a byte above 0x7F all tie on count.
+    const std::vector<std::string> names = {"Z10", "Z1", "Z1!", "Z\xC3\xA9", "Z", "Z0", "z1"};
+    std::string csv;
+    for (const auto& z : names) csv += "1," + z + ",2024-01-01 08:00\n1," + z + ",2024-01-01 09:00\n";
+
+    std::vector<std::string> sorted = names;
+    std::sort(sorted.begin(), sorted.end());
+
+    for (size_t cap : {size_t(0), size_t(32)}) {
+        INFO("index capacity " << cap);
+        TripAnalyzer a;
+        a.setTopKCapacity(cap);
+        a.ingestBuffer(csv.data(), csv.size());
+
+        const auto zones = a.topZones(100);
+        REQUIRE(zones.size() == sorted.size());
+        for (size_t i = 0; i < sorted.size(); i++) {
+            REQUIRE(zones[i].zone == sorted[i]);
+            REQUIRE(zones[i].count == 2);
+        }
+        const auto slots = a.topBusySlots(4);
+        requireSlotsEq(slots, {{sorted[0], 8, 1}, {sorted[0], 9, 1}, {sorted[1], 8, 1}, {sorted[1], 9, 1}});
+    }
+}
+
+TEST_CASE("D18 Time buckets at every granularity", "[D]") {
+    const std::string csv =
+        "TripID,PickupZoneID,PickupTime\n"
+        "1,A,2024-01-01 08:10\n"      // Monday
+        "2,A,2024-01-01 08:20\n"
+        "3,A,2024-01-08 08:05\n"      // next Monday
+        "4,B,2023-12-31 23:59\n"      // Sunday, before the first row's day
+        "5,B,2024-01-01 08:14\n"
+        "6,B,01/01/2024 07:05\n";     // hour parses, date does not
+    const long long day = 19723;      // 2024-01-01
+
+    auto run = [&](TimeBucket unit) {
+        TripAnalyzer a;
+        a.setTimeBucket(unit);
+        a.ingestBuffer(csv.data(), csv.size());
+        return a;
+    };
+    auto requireBuckets = [](const std::vector<BucketCount>& got,
+                             const std::vector<std::tuple<std::string, long long, long long>>& exp) {
+        REQUIRE(got.size() == exp.size());
+        for (size_t i = 0; i < exp.size(); i++) {
+            INFO("Index " << i);
+            REQUIRE(got[i].zone == std::get<0>(exp[i]));
+            REQUIRE(got[i].bucket == std::get<1>(exp[i]));
+            REQUIRE(got[i].count == std::get<2>(exp[i]));
+        }
+    };
+
+    TripAnalyzer hour = run(TimeBucket::HourOfDay);
+    requireBuckets(hour.topBusyBuckets(10), {{"A", 8, 3}, {"B", 7, 1}, {"B", 8, 1}, {"B", 23, 1}});
+    REQUIRE(hour.stats().undatedRows == 0);
+
+    TripAnalyzer quarter = run(TimeBucket::QuarterHour);
+    // Time-of-day units keep the row whose date does not parse.
+    requireBuckets(quarter.topBusyBuckets(10),
+                   {{"A", 32, 2}, {"A", 33, 1}, {"B", 28, 1}, {"B", 32, 1}, {"B", 95, 1}});
+    REQUIRE(quarter.stats().undatedRows == 0);
+
+    requireBuckets(run(TimeBucket::WeekdayHour).topBusyBuckets(10), {{"A", 8, 3}, {"B", 8, 1}, {"B", 167, 1}});
+    requireBuckets(run(TimeBucket::Day).topBusyBuckets(10),
+                   {{"A", day, 2}, {"A", day + 7, 1}, {"B", day - 1, 1}, {"B", day, 1}});
+    requireBuckets(run(TimeBucket::DayHour).topBusyBuckets(3),
+                   {{"A", day * 24 + 8, 2}, {"A", (day + 7) * 24 + 8, 1}, {"B", day * 24 - 1, 1}});
+
+    // Changing granularity drops the counts; None turns bucketing off.
+    hour.setTimeBucket(TimeBucket::Day);
+    REQUIRE(hour.topBusyBuckets(10).empty());
+    REQUIRE(run(TimeBucket::None).topBusyBuckets(10).empty());
+    REQUIRE(hour.topZones(1)[0].count == 3);
+
+    SECTION("far-off dates cost one counter, not a row per zone") {
+        // 200 zones over one week, plus one pickup in year 5000 and one in year 1.
+        std::string dirty = "TripID,PickupZoneID,PickupTime\n";
+        for (int i = 0; i < 200000; i++) {
+            dirty += std::to_string(i) + ",Z" + std::to_string(i % 200) + ",2024-01-0" + std::to_string(1 + i % 7) +
+                     " " + zpad(i % 24, 2) + ":00\n";
+        }
+        dirty += "1,Z0,5000-12-31 10:00\n";
+        dirty += "2,Z1,0001-01-01 00:00\n";
+        for (TimeBucket unit : {TimeBucket::Day, TimeBucket::DayHour}) {
+            for (unsigned t : {1u, 4u}) {
+                INFO("threads=" << t);
+                TripAnalyzer a;
+                a.setTimeBucket(unit);
+                a.setThreadCount(t);
+                a.ingestBuffer(dirty.data(), dirty.size());
+                auto all = a.topBusyBuckets(1 << 20);
+                long long total = 0;
+                for (const auto& b : all) total += b.count;
+                REQUIRE(total == 200002);
+                bool hour = unit == TimeBucket::DayHour;
+                const long long late = hour ? 1107049LL * 24 + 10 : 1107049;
+                const long long early = hour ? -719162LL * 24 : -719162;
+                REQUIRE(std::count_if(all.begin(), all.end(), [&](const BucketCount& b) {
+                            return (b.zone == "Z0" && b.bucket == late) || (b.zone == "Z1" && b.bucket == early);
+                        }) == 2);
+            }
+        }
+    }
+}
+
+TEST_CASE("D19 Date buckets either side of the first row merge across threads", "[D]") {
+    // Dates walk forward and backward from the first row, and workers see
+    // different ranges.
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    for (int i = 0; i < 160000; i++) {
+        int d = (i % 2 ? 1 : -1) * ((i / 2) % 400);
+        int y = 2024, m = 6, day = 15 + d;
+        // Wrap through 28-day months; exact dates are not the point.
+        while (day < 1) { day += 28; if (--m < 1) { m = 12; --y; } }
+        while (day > 28) { day -= 28; if (++m > 12) { m = 1; ++y; } }
+        csv += std::to_string(i) + ",Z" + std::to_string(i % 53) + "," + std::to_string(y) + "-" + zpad(m, 2) + "-" +
+               zpad(day, 2) + " " + zpad(i % 24, 2) + ":30\n";
+    }
+    REQUIRE(csv.size() > (4u << 20));
+
+    for (TimeBucket unit : {TimeBucket::Day, TimeBucket::DayHour, TimeBucket::WeekdayHour}) {
+        TripAnalyzer serial, threaded;
+        serial.setTimeBucket(unit);
+        threaded.setTimeBucket(unit);
+        threaded.setThreadCount(4);
+        serial.ingestBuffer(csv.data(), csv.size());
+        threaded.ingestBuffer(csv.data(), csv.size());
+
+        const auto exp = serial.topBusyBuckets(1 << 20);
+        const auto got = threaded.topBusyBuckets(1 << 20);
+        REQUIRE(!exp.empty());
+        REQUIRE(got.size() == exp.size());
+        long long total = 0;
+        for (size_t i = 0; i < got.size(); i++) {
+            REQUIRE(got[i].zone == exp[i].zone);
+            REQUIRE(got[i].bucket == exp[i].bucket);
+            REQUIRE(got[i].count == exp[i].count);
+            total += got[i].count;
+        }
+        REQUIRE(total == 160000);
+    }
+}
+
+TEST_CASE("D20 Route counts from the dropoff column", "[D]") {
+    const std::string csv =
+        "TripID,PickupZoneID,DropoffZoneID,PickupTime,Distance,Fare\n"
+        "1,A,B,2024-01-01 08:10,1.0,5.0\n"
+        "2,A,B,2024-01-01 09:10,1.0,5.0\n"
+        "3,B,A,2024-01-01 09:10,1.0,5.0\n"
+        "4,A,C,2024-01-01 09:10,1.0,5.0\n"
+        "5,A,A,2024-01-01 09:10,1.0,5.0\n"
+        "6,C,,2024-01-01 09:10,1.0,5.0\n"      // no dropoff
+        "7,C,2024-01-01 10:00\n";               // 3-column row
+    auto requireRoutes = [](const std::vector<RouteCount>& got,
+                            const std::vector<std::tuple<std::string, std::string, long long>>& exp) {
+        REQUIRE(got.size() == exp.size());
+        for (size_t i = 0; i < exp.size(); i++) {
+            INFO("Index " << i);
+            REQUIRE(got[i].pickup == std::get<0>(exp[i]));
+            REQUIRE(got[i].dropoff == std::get<1>(exp[i]));
+            REQUIRE(got[i].count == std::get<2>(exp[i]));
+        }
+    };
+
+    TripAnalyzer a;
+    a.setCountRoutes(true);
+    a.ingestBuffer(csv.data(), csv.size());
+    requireRoutes(a.topRoutes(10), {{"A", "B", 2}, {"A", "A", 1}, {"A", "C", 1}, {"B", "A", 1}});
+    requireRoutes(a.topRoutes(1), {{"A", "B", 2}});
+    requireZonesEq(a.topZones(10), {{"A", 4}, {"C", 2}, {"B", 1}});
+
+    a.appendBuffer(csv.data(), csv.size());
+    requireRoutes(a.topRoutes(2), {{"A", "B", 4}, {"A", "A", 2}});
+
+    TripAnalyzer off;
+    off.ingestBuffer(csv.data(), csv.size());
+    REQUIRE(off.topRoutes(10).empty());
+    a.reset();
+    REQUIRE(a.topRoutes(10).empty());
+
+    SECTION("threaded ingest merges routes exactly") {
+        std::string big = "TripID,PickupZoneID,DropoffZoneID,PickupTime,Distance,Fare\n";
+        for (int i = 0; i < 150000; i++) {
+            big += std::to_string(i) + ",P" + std::to_string(i % 211) + ",D" + std::to_string((i * 13) % 97) +
+                   ",2024-01-01 10:00,1.0,2.0\n";
+        }
+        TripAnalyzer serial, threaded;
+        serial.setCountRoutes(true);
+        threaded.setCountRoutes(true);
+        threaded.setThreadCount(4);
+        serial.ingestBuffer(big.data(), big.size());
+        threaded.ingestBuffer(big.data(), big.size());
+
+        const auto exp = serial.topRoutes(100000);
+        const auto got = threaded.topRoutes(100000);
+        REQUIRE(exp.size() == 211 * 97);
+        REQUIRE(got.size() == exp.size());
+        for (size_t i = 0; i < got.size(); i++) {
+            REQUIRE(got[i].pickup == exp[i].pickup);
+            REQUIRE(got[i].dropoff == exp[i].dropoff);
+            REQUIRE(got[i].count == exp[i].count);
+        }
+    }
+}
+
+TEST_CASE("D21 Fixed-point decimals and per-zone fare and distance totals", "[D]") {
+    auto cents = [](const char* text) {
+        int32_t v = 12345;
+        return parse_hundredths(text, v) ? (long long)v : -999999999LL;
+    };
+    const long long bad = -999999999LL;
+    REQUIRE(cents("16.0") == 1600);
+    REQUIRE(cents("74.9") == 7490);
+    REQUIRE(cents(" 0.07 ") == 7);
+    REQUIRE(cents("-3.25") == -325);
+    REQUIRE(cents("+7") == 700);
+    REQUIRE(cents("7.") == 700);
+    REQUIRE(cents(".5") == 50);
+    REQUIRE(cents("2.345") == 235);
+    REQUIRE(cents("2.3449") == 234);
+    REQUIRE(cents("-2.345") == -235);
+    REQUIRE(cents("19.999") == 2000);
+    REQUIRE(cents("21474836.47") == 2147483647LL);
+    REQUIRE(cents("21474836.48") == bad);
+    REQUIRE(cents("99999999999") == bad);
+    REQUIRE(cents("") == bad);
+    REQUIRE(cents("  ") == bad);
+    REQUIRE(cents("-") == bad);
+    REQUIRE(cents(".") == bad);
+    REQUIRE(cents("1e3") == bad);
+    REQUIRE(cents("1,5") == bad);
+    REQUIRE(cents("12.3.4") == bad);
+    REQUIRE(cents("0x10") == bad);
+
+    std::string csv = "TripID,PickupZoneID,DropoffZoneID,PickupTime,Distance,Fare\n";
+    long long fareSum = 0;
+    int fareMin = INT32_MAX, fareMax = 0, distMax = 0;
+    for (int i = 0; i < 120000; i++) {
+        int fare = 250 + (i * 37) % 9000;   // cents
+        if (i % 2 == 0) {
+            fareSum += fare;
+            fareMin = std::min(fareMin, fare);
+            fareMax = std::max(fareMax, fare);
+            distMax = std::max(distMax, (i % 40) * 100 + i % 100);
+        }
+        csv += std::to_string(i) + (i % 2 ? ",B" : ",A") + ",D,2024-01-01 10:00," + std::to_string(i % 40) + "." +
+               zpad(i % 100, 2) + "," + std::to_string(fare / 100) + "." + zpad(fare % 100, 2) + "\n";
+    }
+    csv += "X,A,D,2024-01-01 10:00,n/a,\n";   // accepted, but both measures unusable
+    REQUIRE(csv.size() > (4u << 20));
+
+    for (unsigned t : {1u, 4u}) {
+        INFO("threads=" << t);
+        TripAnalyzer a;
+        a.setTrackMeasures(true);
+        a.setThreadCount(t);
+        a.ingestBuffer(csv.data(), csv.size());
+
+        const ZoneMeasures m = a.zoneMeasures("A");
+        REQUIRE(m.fare.rows == 60000);
+        REQUIRE(m.fare.sum == fareSum);
+        REQUIRE(m.fare.min == fareMin);
+        REQUIRE(m.fare.max == fareMax);
+        REQUIRE(m.distance.rows == 60000);
+        REQUIRE(m.distance.min == 0);
+        REQUIRE(m.distance.max == distMax);
+        REQUIRE(a.topZones(1)[0].count == 60001);
+
+        REQUIRE(a.zoneMeasures("D").fare.rows == 0);   // dropoff only
+        REQUIRE(a.zoneMeasures("nowhere").fare.rows == 0);
+    }
+
+    TripAnalyzer off;
+    off.ingestBuffer(csv.data(), csv.size());
+    REQUIRE(off.zoneMeasures("A").fare.rows == 0);
+}
+
+TEST_CASE("D22 Zones ranked by revenue, average fare and distance", "[D]") {
+    const std::string csv =
+        "TripID,PickupZoneID,DropoffZoneID,PickupTime,Distance,Fare\n"
+        "1,A,X,2024-01-01 08:00,1.0,10.00\n"
+        "2,A,X,2024-01-01 08:00,1.0,20.00\n"      // A: 30.00 over 2, avg 15.00
+        "3,B,X,2024-01-01 08:00,9.5,30.00\n"      // B: 30.00 over 1, avg 30.00
+        "4,C,X,2024-01-01 08:00,2.0,10.00\n"
+        "5,C,X,2024-01-01 08:00,2.0,10.00\n"
+        "6,C,X,2024-01-01 08:00,2.0,10.01\n"      // C: 30.01 over 3
+        "7,D,X,2024-01-01 08:00,0.5,15.00\n"      // D: avg ties A exactly
+        "8,E,X,2024-01-01 08:00,,\n";             // no measures: never ranked
+    auto requireMetrics = [](const std::vector<ZoneMetric>& got,
+                             const std::vector<std::tuple<std::string, long long, long long>>& exp) {
+        REQUIRE(got.size() == exp.size());
+        for (size_t i = 0; i < exp.size(); i++) {
+            INFO("Index " << i);
+            REQUIRE(got[i].zone == std::get<0>(exp[i]));
+            REQUIRE(got[i].sum == std::get<1>(exp[i]));
+            REQUIRE(got[i].rows == std::get<2>(exp[i]));
+        }
+    };
+
+    TripAnalyzer a;
+    a.setTrackMeasures(true);
+    a.ingestBuffer(csv.data(), csv.size());
+
+    requireMetrics(a.topZonesByRevenue(10), {{"C", 3001, 3}, {"A", 3000, 2}, {"B", 3000, 1}, {"D", 1500, 1}});
+    requireMetrics(a.topZonesByAvgFare(10), {{"B", 3000, 1}, {"A", 3000, 2}, {"D", 1500, 1}, {"C", 3001, 3}});
+    REQUIRE(a.topZonesByAvgFare(1)[0].value == 3000.0);
+    REQUIRE(a.topZonesByAvgFare(2)[1].value == 1500.0);
+    requireMetrics(a.topZonesByDistance(2), {{"B", 950, 1}, {"C", 600, 3}});
+    REQUIRE(a.topZonesByRevenue(0).empty());
+
+    TripAnalyzer off;
+    off.ingestBuffer(csv.data(), csv.size());
+    REQUIRE(off.topZonesByRevenue(10).empty());
+}
+
+TEST_CASE("D23 KLL fare sketches: bounded size, mergeable, close to exact ranks", "[D]") {
+    const int N = 200000;
+    auto value = [](int i) { return (int32_t)(((long long)i * 7919) % N); };   // a permutation of 0..N-1
+    auto requireClose = [&](const KllSketch& s) {
+        REQUIRE(s.count() == (uint64_t)N);
+        REQUIRE(s.quantile(0.0) == 0);
+        REQUIRE(s.quantile(1.0) == N - 1);
+        for (double q : {0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99}) {
+            INFO("q=" << q);
+            REQUIRE(std::abs(s.quantile(q) - q * N) <= 0.03 * N);
+        }
+        REQUIRE(s.retained() <= 4 * KllSketch::kK);
+        REQUIRE(s.heapBytes() <= 1800);   // levels give their room back when compacted
+    };
+
+    KllSketch whole;
+    for (int i = 0; i < N; i++) whole.add(value(i));
+    requireClose(whole);
+
+    KllSketch parts[4], merged;
+    for (int i = 0; i < N; i++) parts[i % 4].add(value(i));
+    for (const auto& p : parts) merged.merge(p);
+    requireClose(merged);
+
+    // Deep sketches must not drift: every level alternates which half it keeps.
+    const int Big = 4000000;
+    KllSketch deep;
+    for (long long i = 0; i < Big; i++) deep.add((int32_t)((i * 2654435761LL) % Big));
+    for (double q : {0.1, 0.5, 0.9}) REQUIRE(std::abs(deep.quantile(q) - q * Big) <= 0.02 * Big);
+    REQUIRE(deep.retained() <= 4 * KllSketch::kK);
+    REQUIRE(deep.heapBytes() <= 1800);
+
+    KllSketch small;
+    REQUIRE(small.quantile(0.5) == INT32_MIN);
+    for (int32_t v : {500, 100, 300}) small.add(v);
+    REQUIRE(small.quantile(0.0) == 100);
+    REQUIRE(small.quantile(0.5) == 300);
+    REQUIRE(small.quantile(0.9) == 500);
+    REQUIRE(small.retained() == 3);
+    REQUIRE(small.heapBytes() <= 64);
+
+    SECTION("per-zone sketches through ingest") {
+        // One busy zone with fares 0.00-19.99 and many single-trip zones.
+        std::string csv = "TripID,PickupZoneID,DropoffZoneID,PickupTime,Distance,Fare\n";
+        for (int i = 0; i < 100000; i++) {
+            int cents = (i * 7919) % 2000;
+            csv += std::to_string(i) + ",BUSY,D,2024-01-01 10:00,1.0," + std::to_string(cents / 100) + "." +
+                   zpad(cents % 100, 2) + "\n";
+            if (i % 2 == 0) csv += std::to_string(i) + ",Z" + std::to_string(i) + ",D,2024-01-01 10:00,1.0,7.25\n";
+        }
+        for (unsigned t : {1u, 4u}) {
+            INFO("threads=" << t);
+            TripAnalyzer a;
+            a.setFareQuantiles(true);
+            a.setThreadCount(t);
+            a.ingestBuffer(csv.data(), csv.size());
+
+            REQUIRE(a.fareQuantile("BUSY", 0.0) == 0);
+            REQUIRE(a.fareQuantile("BUSY", 1.0) == 1999);
+            REQUIRE(std::abs(a.fareQuantile("BUSY", 0.5) - 1000) <= 60);
+            REQUIRE(std::abs(a.fareQuantile("BUSY", 0.95) - 1900) <= 60);
+            REQUIRE(a.fareQuantile("Z4242", 0.5) == 725);
+            REQUIRE(a.fareQuantile("D", 0.5) == TripColumns::kNoValue);
+            REQUIRE(a.fareQuantile("nowhere", 0.5) == TripColumns::kNoValue);
+        }
+    }
+}
+
+TEST_CASE("D24 Space-Saving heavy hitters: flat memory, bounded error", "[D]") {
+    // Skewed stream: key i % 50 on every third item, a fresh key otherwise.
+    std::map<std::string, long long> exact;
+    SpaceSaving s(64), halves[2];
+    for (auto& h : halves) h.setCapacity(64);
+    for (int i = 0; i < 30000; i++) {
+        std::string key = i % 3 == 0 ? "hot" + std::to_string(i % 50) : "cold" + std::to_string(i);
+        exact[key] += 1;
+        s.add(key);
+        halves[i % 2].add(key);
+    }
+    SpaceSaving merged(64);
+    for (const auto& h : halves) merged.merge(h);
+
+    for (const SpaceSaving* sum : {&s, &merged}) {
+        REQUIRE(sum->size() == 64);
+        REQUIRE(sum->total() == 30000);
+        REQUIRE(sum->untrackedBound() <= 30000 / 64);
+        long long counted = 0;
+        for (const auto& c : sum->entries()) {
+            INFO(c.key);
+            REQUIRE(c.count - c.error <= exact[c.key]);
+            REQUIRE(exact[c.key] <= c.count);
+            counted += c.count;
+        }
+        if (sum == &s) REQUIRE(counted == 30000);   // every item sits in exactly one counter
+        for (const auto& e : exact) {
+            bool tracked = std::any_of(sum->entries().begin(), sum->entries().end(),
+                                       [&](const SpaceSaving::Counter& c) { return c.key == e.first; });
+            if (!tracked) REQUIRE(e.second <= sum->untrackedBound());
+        }
+    }
+
+    SECTION("the bound holds when small worker summaries are merged") {
+        // Heavy zones throughout, 3000 one-off zones only in the middle third;
+        // rejected padding spreads the rows over three worker-sized ranges.
+        std::string csv = "TripID,PickupZoneID,PickupTime\n";
+        const std::string pad = std::string(199, 'x') + "\n";
+        for (int part = 0; part < 3; part++) {
+            size_t end = csv.size() + ((size_t)11 << 17);
+            for (int i = 0; i < 3000; i++) {
+                csv += "1,H" + std::to_string(i % 7) + ",2024-01-01 10:00\n";
+                if (i % 3 == 0) csv += "1,H" + std::to_string(i % 2) + ",2024-01-01 11:00\n";
+                if (part == 1) csv += "1,U" + std::to_string(i) + ",2024-01-01 12:00\n";
+            }
+            while (csv.size() < end) csv += pad;
+        }
+
+        TripAnalyzer exactAnalyzer;
+        exactAnalyzer.ingestBuffer(csv.data(), csv.size());
+        for (unsigned t : {1u, 3u, 4u}) {
+            INFO("threads=" << t);
+            TripAnalyzer a;
+            a.setThreadCount(t);
+            a.setApproximateMemory(40000);
+            a.ingestBuffer(csv.data(), csv.size());
+            long long bound = a.approximateBound();
+            REQUIRE(bound > 0);
+
+            std::map<std::string, SpaceSaving::Counter> got;
+            for (const auto& e : a.topZonesApprox(1 << 20)) got[e.zone] = {e.zone, e.count, e.error, 0};
+            for (const auto& z : exactAnalyzer.topZones(1 << 20)) {
+                INFO(z.zone << " x" << z.count << ", bound " << bound);
+                auto it = got.find(z.zone);
+                if (it == got.end()) {
+                    REQUIRE(z.count <= bound);
+                } else {
+                    REQUIRE(it->second.count - it->second.error <= z.count);
+                    REQUIRE(z.count <= it->second.count);
+                }
+            }
+            std::map<std::pair<std::string, int>, long long> slots;
+            for (const auto& e : a.topBusySlotsApprox(1 << 20)) slots[{e.zone, e.hour}] = e.count;
+            for (const auto& s : exactAnalyzer.topBusySlots(1 << 20)) {
+                if (s.count > bound) REQUIRE(slots.count({s.zone, s.hour}) == 1);
+            }
+        }
+    }
+
+    SECTION("topZones and topBusySlots through ingest") {
+        // Five heavy zones at fixed hours among 200k single-trip zones.
+        std::string csv = "TripID,PickupZoneID,PickupTime\n";
+        const int heavy[5] = {9000, 7000, 5000, 3000, 1000};
+        for (int i = 0; i < 200000; i++) {
+            csv += std::to_string(i) + ",T" + std::to_string(i) + ",2024-01-01 03:15\n";
+            for (int z = 0; z < 5; z++) {
+                if (i % (200000 / heavy[z]) == 0) {
+                    csv += std::to_string(i) + ",H" + std::to_string(z) + ",2024-01-01 " + zpad(10 + z, 2) + ":00\n";
+                }
+            }
+        }
+
+        TripAnalyzer exactAnalyzer;
+        exactAnalyzer.ingestBuffer(csv.data(), csv.size());
+        auto want = exactAnalyzer.topZones(5);
+        auto wantSlots = exactAnalyzer.topBusySlots(5);
+
+        for (unsigned t : {1u, 4u}) {
+            INFO("threads=" << t);
+            TripAnalyzer a;
+            a.setThreadCount(t);
+            a.setApproximateMemory(1 << 20);
+            size_t counters = a.approximateCounters();
+            REQUIRE(counters > 1000);
+            REQUIRE(SpaceSaving::bytesFor(counters) * 4 <= (1u << 20));
+            a.ingestBuffer(csv.data(), csv.size());
+
+            long long rows = a.stats().rowsAccepted;
+            REQUIRE(rows == exactAnalyzer.stats().rowsAccepted);
+            REQUIRE(a.approximateBound() <= 2 * (long long)t * rows / (long long)counters);
+            REQUIRE(a.stats().distinctZones == 0);
+
+            auto est = a.topZonesApprox(5);
+            auto got = a.topZones(5);
+            REQUIRE(est.size() == 5);
+            REQUIRE(got.size() == 5);
+            for (int z = 0; z < 5; z++) {
+                REQUIRE(got[z].zone == want[z].zone);
+                REQUIRE(est[z].count - est[z].error <= want[z].count);
+                REQUIRE(want[z].count <= est[z].count);
+                REQUIRE(got[z].count == est[z].count);
+            }
+
+            auto slots = a.topBusySlotsApprox(5);
+            REQUIRE(slots.size() == 5);
+            for (int z = 0; z < 5; z++) {
+                REQUIRE(slots[z].zone == wantSlots[z].zone);
+                REQUIRE(slots[z].hour == wantSlots[z].hour);
+                REQUIRE(slots[z].count - slots[z].error <= wantSlots[z].count);
+                REQUIRE(wantSlots[z].count <= slots[z].count);
+            }
+
+            // Appends keep counting into the same bounded summaries.
+            a.appendBuffer(csv.data(), csv.size());
+            REQUIRE(a.approximateCounters() == counters);
+            REQUIRE(a.topZones(1)[0].zone == "H0");
+            REQUIRE(a.topZones(1)[0].count >= 2 * want[0].count);
+        }
+
+        TripAnalyzer off;
+        off.setApproximateMemory(1 << 20);
+        off.setApproximateMemory(0);
+        off.ingestBuffer(csv.data(), csv.size());
+        REQUIRE(off.topZones(5).size() == 5);
+        REQUIRE(off.topZones(5)[4].count == want[4].count);
+        REQUIRE(off.topZonesApprox(5).empty());
+
+        // Summaries cannot be written as a snapshot, but an exact snapshot
+        // seeds them, leaving no dictionary behind.
+        const std::string snap = (fs::temp_directory_path() / "d24_trips.snap").string();
+        TripAnalyzer summarised;
+        summarised.setApproximateMemory(1 << 20);
+        summarised.ingestBuffer(csv.data(), csv.size());
+        REQUIRE(!summarised.saveSnapshot(snap));
+        REQUIRE(exactAnalyzer.saveSnapshot(snap));
+        REQUIRE(summarised.loadSnapshot(snap));
+        fs::remove(snap);
+        auto seeded = summarised.topZones(5);
+        REQUIRE(seeded.size() == 5);
+        for (int z = 0; z < 5; z++) REQUIRE(seeded[z].zone == want[z].zone);
+        REQUIRE(summarised.zoneId("H0") == TripColumns::kNoZone);
+        REQUIRE(summarised.stats().distinctZones == 0);
+        REQUIRE(summarised.approximateCounters() > 1000);
+    }
+}
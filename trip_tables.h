@@ -0,0 +1,737 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "flat_index.h"
+#include "kll_sketch.h"
+#include "space_saving.h"
+
+// Counters describing the work done by ingest and append calls. Rows are
+// lines handed to the parser (detected header rows are not); every one is
+// either accepted or rejected for exactly one reason. Phase times are summed
+// over worker threads. For mapped files, page faults show up as split time.
+struct IngestStats {
+    long long bytesRead = 0;
+    long long rowsSeen = 0;
+    long long rowsAccepted = 0;
+    long long rejectedMissingZone = 0;   // empty line, no zone field, or blank zone
+    long long rejectedBadTime = 0;       // time field missing or not "date HH:MM"-shaped
+    long long rejectedBadHour = 0;       // hour not 0-23
+    long long rejectedBadMinute = 0;     // minute not two digits 00-59
+    long long slowPathRows = 0;          // accepted via the tolerant time parser
+    long long undatedRows = 0;           // accepted, but the date is not Y-M-D; counted only
+                                         // while rows are retained or buckets are dated
+    long long distinctZones = 0;
+
+    long long readNs = 0;        // stream reads and file mapping
+    long long splitNs = 0;       // finding rows and commas
+    long long parseNs = 0;       // zone trimming and time parsing
+    long long aggregateNs = 0;   // zone interning and counter updates
+
+    // Pre-sizing (setPresize): rows and distinct zones estimated from the
+    // sampled prefix of the most recent buffer or file, and index rehashes the
+    // up-front reservation saved.
+    long long estimatedRows = 0;
+    long long estimatedZones = 0;
+    long long rehashesAvoided = 0;
+
+    long long rowsRejected() const {
+        return rejectedMissingZone + rejectedBadTime + rejectedBadHour + rejectedBadMinute;
+    }
+
+    // Sum the per-row and timing counters of another worker.
+    void add(const IngestStats& o) {
+        bytesRead += o.bytesRead;
+        rowsSeen += o.rowsSeen;
+        rowsAccepted += o.rowsAccepted;
+        rejectedMissingZone += o.rejectedMissingZone;
+        rejectedBadTime += o.rejectedBadTime;
+        rejectedBadHour += o.rejectedBadHour;
+        rejectedBadMinute += o.rejectedBadMinute;
+        slowPathRows += o.slowPathRows;
+        undatedRows += o.undatedRows;
+        readNs += o.readNs;
+        splitNs += o.splitNs;
+        parseNs += o.parseNs;
+        aggregateNs += o.aggregateNs;
+    }
+};
+
+// Per-zone aggregate kept by TripAnalyzer: total trips plus one counter per
+// pickup hour, so a slot update is a single indexed increment.
+struct ZoneTally {
+    long long trips = 0;
+    std::array<long long, 24> hourly{};
+};
+
+// Sum, extremes and row count of one measure over a zone's pickups, in
+// fixed-point hundredths. min > max while rows == 0.
+struct MeasureRange {
+    long long sum = 0;
+    long long rows = 0;
+    int32_t min = INT32_MAX;
+    int32_t max = INT32_MIN;
+
+    void add(int32_t v) {
+        sum += v;
+        rows += 1;
+        if (v < min) min = v;
+        if (v > max) max = v;
+    }
+
+    void add(const MeasureRange& o) {
+        sum += o.sum;
+        rows += o.rows;
+        if (o.min < min) min = o.min;
+        if (o.max > max) max = o.max;
+    }
+};
+
+// Fare and distance aggregates of one zone's pickups. A row whose field is
+// missing or not a plain decimal is left out of that measure only.
+struct ZoneMeasures {
+    MeasureRange fare;
+    MeasureRange distance;
+
+    void add(const ZoneMeasures& o) {
+        fare.add(o.fare);
+        distance.add(o.distance);
+    }
+};
+
+// Bump-pointer store for key bytes. Keys are appended back to back into one
+// buffer and addressed by (offset, length), so growing the buffer never
+// invalidates a reference and teardown is a single free.
+class KeyArena {
+public:
+    struct Ref {
+        uint64_t offset;
+        uint32_t length;
+    };
+
+    Ref add(std::string_view key) {
+        Ref r{bytes.size(), (uint32_t)key.size()};
+        bytes.insert(bytes.end(), key.begin(), key.end());
+        return r;
+    }
+
+    std::string_view view(Ref r) const { return std::string_view(bytes.data() + r.offset, r.length); }
+    size_t size() const { return bytes.size(); }
+    void reserve(size_t n) { bytes.reserve(n); }
+    void clear() { bytes.clear(); }
+
+private:
+    std::vector<char> bytes;
+};
+
+// Interns zone strings to dense ids handed out in first-seen order.
+// Lookups take a string_view and never allocate on a hit; a new zone's bytes
+// are appended to the arena. The FlatIndex maps hashes to ids and reads keys
+// back through `refs`.
+class ZoneDictionary {
+public:
+    uint32_t intern(std::string_view zone) {
+        uint32_t h = FlatIndex::hash(zone);
+        uint32_t id = index.find(zone, h, [this](uint32_t i) { return name(i); });
+        if (id != FlatIndex::npos) return id;
+        id = (uint32_t)refs.size();
+        refs.push_back(arena.add(zone));
+        index.insert(h, id);
+        return id;
+    }
+
+    // Id of an interned zone, or FlatIndex::npos.
+    uint32_t find(std::string_view zone) const {
+        return index.find(zone, FlatIndex::hash(zone), [this](uint32_t i) { return name(i); });
+    }
+
+    std::string_view name(uint32_t id) const { return arena.view(refs[id]); }
+    size_t size() const { return refs.size(); }
+    bool empty() const { return refs.empty(); }
+    size_t indexCapacity() const { return index.capacity(); }
+    size_t rehashes() const { return index.rehashes(); }
+
+    // Room for n zones of about avgBytes each.
+    void reserve(size_t n, size_t avgBytes = 8) {
+        refs.reserve(n);
+        arena.reserve(n * avgBytes);
+        index.reserve(n);
+    }
+
+    void clear() {
+        index.clear();
+        refs.clear();
+        arena.clear();
+    }
+
+private:
+    KeyArena arena;
+    std::vector<KeyArena::Ref> refs;    // indexed by zone id
+    FlatIndex index;
+};
+
+// Accepted rows kept column by column for later scans (TripAnalyzer::
+// setRetainRows). Row i is element i of every vector. Zone ids come from the
+// tables' dictionary; distance and fare are fixed-point hundredths.
+struct TripColumns {
+    static constexpr uint32_t kNoZone = FlatIndex::npos;
+    static constexpr int32_t kNoValue = INT32_MIN;   // time, distance or fare absent or unparsable
+
+    std::vector<uint32_t> pickup;
+    std::vector<uint8_t> hour;
+    std::vector<uint32_t> dropoff;      // kNoZone when the row has none
+    std::vector<int32_t> minutes;       // pickup time as minutes since 1970-01-01 00:00
+    std::vector<int32_t> distance;
+    std::vector<int32_t> fare;
+
+    size_t size() const { return pickup.size(); }
+    bool empty() const { return pickup.empty(); }
+
+    void push(uint32_t pickupId, int pickupHour, uint32_t dropoffId, int32_t time, int32_t dist, int32_t fareValue) {
+        pickup.push_back(pickupId);
+        hour.push_back((uint8_t)pickupHour);
+        dropoff.push_back(dropoffId);
+        minutes.push_back(time);
+        distance.push_back(dist);
+        fare.push_back(fareValue);
+    }
+
+    void clear() {
+        pickup.clear();
+        hour.clear();
+        dropoff.clear();
+        minutes.clear();
+        distance.clear();
+        fare.clear();
+    }
+};
+
+// Counts per 64-bit key, in practice a pair of ids packed as hi << 32 | lo.
+// An open-addressing table with linear probing, kept at most half full;
+// table() exposes the slots, empty ones keyed kEmpty.
+class PairCounts {
+public:
+    static constexpr uint64_t kEmpty = UINT64_MAX;
+
+    struct Slot {
+        uint64_t key;
+        long long count;
+    };
+
+    static uint64_t pack(uint32_t hi, uint32_t lo) { return (uint64_t)hi << 32 | lo; }
+
+    size_t size() const { return used; }   // distinct keys
+    const std::vector<Slot>& table() const { return slots; }
+
+    void add(uint64_t key, long long n = 1) {
+        if ((used + 1) * 2 > slots.size()) grow(slots.empty() ? 64 : slots.size() * 2);
+        for (size_t i = slot_of(key);; i = (i + 1) & mask) {
+            Slot& s = slots[i];
+            if (s.key == key) {
+                s.count += n;
+                return;
+            }
+            if (s.key == kEmpty) {
+                s = Slot{key, n};
+                ++used;
+                return;
+            }
+        }
+    }
+
+    void clear() {
+        slots.clear();
+        mask = 0;
+        used = 0;
+    }
+
+private:
+    size_t slot_of(uint64_t key) const {
+        uint64_t h = key * 0x9E3779B97F4A7C15ull;
+        return (size_t)(h ^ (h >> 32)) & mask;
+    }
+
+    void grow(size_t capacity) {
+        std::vector<Slot> old;
+        old.swap(slots);
+        slots.assign(capacity, Slot{kEmpty, 0});
+        mask = capacity - 1;
+        for (const Slot& s : old) {
+            if (s.key == kEmpty) continue;
+            size_t i = slot_of(s.key);
+            while (slots[i].key != kEmpty) i = (i + 1) & mask;
+            slots[i] = s;
+        }
+    }
+
+    std::vector<Slot> slots;
+    size_t mask = 0;
+    size_t used = 0;
+};
+
+// Time granularities for bucketed slot counts (TripAnalyzer::setTimeBucket).
+// Bucket numbers:
+//   HourOfDay    0-23
+//   QuarterHour  0-95, 15-minute interval of the day
+//   WeekdayHour  0-167, weekday * 24 + hour with Monday = 0
+//   Day          days since 1970-01-01
+//   DayHour      hours since 1970-01-01 00:00
+// Rows whose date does not parse are left out of WeekdayHour, Day and
+// DayHour (IngestStats::undatedRows); the others only need the time of day.
+enum class TimeBucket : uint8_t { None, HourOfDay, QuarterHour, WeekdayHour, Day, DayHour };
+
+// Trip counts per (zone id, bucket) at one granularity. The fixed domains
+// keep one dense row of span() counters per zone, so an update is a single
+// indexed increment. Day and DayHour have no fixed range, and one stray date
+// would stretch a dense row for every zone, so they count in a PairCounts
+// keyed by zone << 32 | bucket instead: memory follows the distinct
+// (zone, bucket) pairs seen, about 32 bytes each.
+class BucketCounts {
+public:
+    TimeBucket unit() const { return unit_; }
+    bool enabled() const { return unit_ != TimeBucket::None; }
+    bool timed() const { return enabled() && unit_ != TimeBucket::HourOfDay; }   // needs the minute
+    bool dated() const { return timed() && unit_ != TimeBucket::QuarterHour; }   // needs the date
+    bool empty() const { return dense.empty() && sparse.size() == 0; }
+
+    // Switch granularity, dropping all counts.
+    void setUnit(TimeBucket unit) {
+        unit_ = unit;
+        clear();
+    }
+
+    // Bucket of a pickup at `minutes` since the epoch, `hour` and `minute`
+    // (0-59); false when the unit needs a date and the row has none
+    // (minutes == INT32_MIN).
+    bool bucketOf(int32_t minutes, int hour, int minute, int32_t& out) const {
+        switch (unit_) {
+        case TimeBucket::HourOfDay: out = hour; return true;
+        case TimeBucket::QuarterHour: out = hour * 4 + minute / 15; return true;
+        default: break;
+        }
+        if (minutes == INT32_MIN) return false;
+        int32_t day = floor_div(minutes, 1440);
+        switch (unit_) {
+        case TimeBucket::WeekdayHour: out = ((day % 7 + 7 + 3) % 7) * 24 + hour; break;   // 1970-01-01 was a Thursday
+        case TimeBucket::Day: out = day; break;
+        case TimeBucket::DayHour: out = floor_div(minutes, 60); break;
+        default: return false;
+        }
+        return true;
+    }
+
+    void add(uint32_t zone, int32_t bucket, long long n = 1) {
+        if (span != 0) {
+            size_t need = ((size_t)zone + 1) * span;
+            if (dense.size() < need) dense.resize(need, 0);
+            dense[(size_t)zone * span + (size_t)bucket] += n;
+            return;
+        }
+        sparse.add(PairCounts::pack(zone, (uint32_t)bucket), n);
+    }
+
+    // Positions forEach walks: zones for the dense units, table slots for
+    // the sparse ones. Disjoint position ranges can be scanned in parallel.
+    size_t positions() const { return span != 0 ? dense.size() / span : sparse.table().size(); }
+
+    // Calls fn(zone, bucket, count) for every non-zero count at positions
+    // [begin, end).
+    template <class Fn>
+    void forEach(size_t begin, size_t end, Fn&& fn) const {
+        if (span != 0) {
+            for (size_t z = begin; z < end; ++z) {
+                for (size_t b = 0; b < span; ++b) {
+                    if (long long c = dense[z * span + b]) fn((uint32_t)z, (int32_t)b, c);
+                }
+            }
+            return;
+        }
+        const std::vector<PairCounts::Slot>& slots = sparse.table();
+        for (size_t i = begin; i < end; ++i) {
+            const PairCounts::Slot& s = slots[i];
+            if (s.key != PairCounts::kEmpty) fn((uint32_t)(s.key >> 32), (int32_t)(uint32_t)s.key, s.count);
+        }
+    }
+
+    void clear() {
+        dense.clear();
+        span = fixedSpan();
+        sparse.clear();
+    }
+
+    // Fold in another worker's counts; remap translates its zone ids.
+    void merge(const BucketCounts& o, const std::vector<uint32_t>& remap) {
+        o.forEach(0, o.positions(), [&](uint32_t zone, int32_t bucket, long long c) { add(remap[zone], bucket, c); });
+    }
+
+private:
+    static int32_t floor_div(int32_t a, int32_t b) { return a / b - (a % b < 0); }
+
+    size_t fixedSpan() const {
+        switch (unit_) {
+        case TimeBucket::HourOfDay: return 24;
+        case TimeBucket::QuarterHour: return 96;
+        case TimeBucket::WeekdayHour: return 168;
+        default: return 0;
+        }
+    }
+
+    TimeBucket unit_ = TimeBucket::None;
+    size_t span = 0;                 // buckets per zone of a fixed domain, else 0
+    std::vector<long long> dense;    // zone-major, span per zone
+    PairCounts sparse;               // Day / DayHour
+};
+
+// Trip counts per (pickup, dropoff) zone-id pair. Pairs are counted in a
+// PairCounts keyed by pickup << 32 | dropoff. finalize() lays the pairs out as CSR rows for queries: row p holds
+// the dropoffs of pickup id p in ascending id order, with their counts.
+class RouteCounts {
+public:
+    size_t size() const { return pairs.size(); }   // distinct pairs
+
+    void add(uint32_t pickup, uint32_t dropoff, long long n = 1) { pairs.add(PairCounts::pack(pickup, dropoff), n); }
+
+    // Rebuild the CSR rows for pickup ids [0, zones). Two counting-sort
+    // passes, by dropoff and then stably by pickup, leave every row in
+    // dropoff order.
+    void finalize(size_t zones) {
+        using Slot = PairCounts::Slot;
+        std::vector<uint64_t> start(zones + 1, 0);
+        for (const Slot& s : pairs.table()) {
+            if (s.key != PairCounts::kEmpty) ++start[(uint32_t)s.key + 1];
+        }
+        for (size_t z = 0; z < zones; ++z) start[z + 1] += start[z];
+        std::vector<Slot> byDropoff(pairs.size());
+        for (const Slot& s : pairs.table()) {
+            if (s.key != PairCounts::kEmpty) byDropoff[start[(uint32_t)s.key]++] = s;
+        }
+
+        rowStart.assign(zones + 1, 0);
+        for (const Slot& s : byDropoff) ++rowStart[(s.key >> 32) + 1];
+        for (size_t z = 0; z < zones; ++z) rowStart[z + 1] += rowStart[z];
+        start.assign(rowStart.begin(), rowStart.end() - 1);
+        cols.resize(pairs.size());
+        counts.resize(pairs.size());
+        for (const Slot& s : byDropoff) {
+            uint64_t at = start[s.key >> 32]++;
+            cols[at] = (uint32_t)s.key;
+            counts[at] = s.count;
+        }
+    }
+
+    // CSR view, valid after finalize().
+    size_t rows() const { return rowStart.empty() ? 0 : rowStart.size() - 1; }
+    uint64_t rowBegin(size_t pickup) const { return rowStart[pickup]; }
+    uint64_t rowEnd(size_t pickup) const { return rowStart[pickup + 1]; }
+    uint32_t dropoff(uint64_t i) const { return cols[i]; }
+    long long count(uint64_t i) const { return counts[i]; }
+
+    void clear() {
+        pairs.clear();
+        rowStart.clear();
+        cols.clear();
+        counts.clear();
+    }
+
+    // Fold in another worker's pairs; remap translates its zone ids.
+    void merge(const RouteCounts& o, const std::vector<uint32_t>& remap) {
+        for (const PairCounts::Slot& s : o.pairs.table()) {
+            if (s.key != PairCounts::kEmpty) add(remap[s.key >> 32], remap[(uint32_t)s.key], s.count);
+        }
+    }
+
+private:
+    PairCounts pairs;
+    std::vector<uint64_t> rowStart;
+    std::vector<uint32_t> cols;
+    std::vector<long long> counts;
+};
+
+// Exact top-`capacity` ids under counts that only grow, kept as a binary heap
+// with the weakest member on top. A non-member can only enter by beating that
+// weakest member, so every update costs O(log capacity) and queries for
+// k <= capacity never look at the rest of the table. `before(a, b)` is the
+// strict ranking order (a ranks ahead of b), led by countOf(id) descending.
+// Nothing is kept per id. Members count at least as much as the weakest, and
+// a member that was just touched more than that, so an id counting less can
+// be turned away and one counting the same can only be a newcomer, each on a
+// count comparison; only a larger count needs a scan of the few members.
+// Capacity 0 disables the index.
+class TopKIndex {
+public:
+    explicit TopKIndex(size_t capacity = 0) : cap(capacity) {}
+
+    size_t capacity() const { return cap; }
+    const std::vector<uint32_t>& members() const { return heap; }
+
+    void clear() { heap.clear(); }
+
+    void reset(size_t capacity) {
+        clear();
+        cap = capacity;
+    }
+
+    // Call once each time id's count increases, or once per id to seed.
+    template <class CountOf, class Before>
+    void touch(uint32_t id, const CountOf& countOf, const Before& before) {
+        if (cap == 0) return;
+        long long count = countOf(id);
+        if (!heap.empty()) {
+            long long weakest = countOf(heap[0]);
+            if (count < weakest && heap.size() == cap) return;
+            if (count > weakest || heap[0] == id) {
+                for (size_t i = 0; i < heap.size(); ++i) {
+                    if (heap[i] == id) {
+                        siftDown(i, before);
+                        return;
+                    }
+                }
+            }
+        }
+        if (heap.size() < cap) {
+            heap.push_back(id);
+            siftUp(heap.size() - 1, before);
+        } else if (before(id, heap[0])) {
+            heap[0] = id;
+            siftDown(0, before);
+        }
+    }
+
+private:
+    void place(size_t i, uint32_t id) { heap[i] = id; }
+
+    template <class Before>
+    void siftUp(size_t i, const Before& before) {
+        uint32_t id = heap[i];
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            if (!before(heap[parent], id)) break;
+            place(i, heap[parent]);
+            i = parent;
+        }
+        place(i, id);
+    }
+
+    template <class Before>
+    void siftDown(size_t i, const Before& before) {
+        uint32_t id = heap[i];
+        for (;;) {
+            size_t child = 2 * i + 1;
+            if (child >= heap.size()) break;
+            if (child + 1 < heap.size() && before(heap[child], heap[child + 1])) ++child;
+            if (!before(id, heap[child])) break;
+            place(i, heap[child]);
+            i = child;
+        }
+        place(i, id);
+    }
+
+    size_t cap;
+    std::vector<uint32_t> heap;   // weakest member at heap[0]
+};
+
+// Zone dictionary plus the counters indexed by its ids. Each ingest worker
+// fills its own; merge() folds another worker's tables in by zone name.
+// With a non-zero top capacity, zoneTop and slotTop (slot id = zone id * 24 +
+// hour) track the leading zones and slots as counts change.
+// With keepRows set, accepted rows are also appended to `columns`; with
+// countRoutes, (pickup, dropoff) pairs are counted in `routes`. Either way
+// dropoff zones are interned too, so zones with no pickups (trips == 0)
+// exist; pickupZones counts the others. With keepMeasures, `measures` sums
+// distance and fare per pickup zone; with keepFareSketches, `fareSketches`
+// summarises each pickup zone's fare distribution.
+// With a non-zero approxCounters nothing above is filled: pickups only feed
+// the bounded Space-Saving summaries heavyZones and heavySlots (key: zone
+// name plus one byte holding the hour), so memory stays flat.
+struct TripTables {
+    ZoneDictionary zones;
+    std::vector<ZoneTally> tallies;    // indexed by zone id
+    IngestStats stats;
+    TopKIndex zoneTop;
+    TopKIndex slotTop;
+    size_t pickupZones = 0;
+    bool keepRows = false;
+    TripColumns columns;
+    BucketCounts buckets;
+    bool countRoutes = false;
+    RouteCounts routes;
+    bool keepMeasures = false;
+    std::vector<ZoneMeasures> measures;   // indexed by zone id, grown on demand
+    bool keepFareSketches = false;
+    std::vector<KllSketch> fareSketches;  // indexed by zone id, grown on demand
+    size_t approxBytes = 0;      // heavy-hitter budget, see TripAnalyzer::setApproximateMemory
+    size_t approxCounters = 0;   // per summary
+    SpaceSaving heavyZones;
+    SpaceSaving heavySlots;
+
+    explicit TripTables(size_t topCapacity = 0) : zoneTop(topCapacity), slotTop(topCapacity) {}
+
+    uint32_t intern(std::string_view zone) {
+        uint32_t id = zones.intern(zone);
+        if (id == tallies.size()) tallies.emplace_back();
+        return id;
+    }
+
+    void count(uint32_t id, int hour) {
+        ZoneTally& t = tallies[id];
+        if (t.trips++ == 0) ++pickupZones;
+        t.hourly[hour] += 1;
+        touch(id, hour);
+    }
+
+    // Add one pickup's distance and fare (TripColumns::kNoValue when absent).
+    void measure(uint32_t id, int32_t distance, int32_t fare) {
+        if (id >= measures.size()) measures.resize(zones.size());
+        ZoneMeasures& m = measures[id];
+        if (distance != TripColumns::kNoValue) m.distance.add(distance);
+        if (fare != TripColumns::kNoValue) m.fare.add(fare);
+    }
+
+    void sketchFare(uint32_t id, int32_t fare) {
+        if (fare == TripColumns::kNoValue) return;
+        if (id >= fareSketches.size()) fareSketches.resize(zones.size());
+        fareSketches[id].add(fare);
+    }
+
+    void countApprox(std::string_view zone, int hour) {
+        heavyZones.add(zone);
+        countApprox(zone, hour, 1);
+    }
+
+    // Slot summary only.
+    void countApprox(std::string_view zone, int hour, long long n) {
+        slotKey.assign(zone.data(), zone.size());
+        slotKey.push_back((char)hour);
+        heavySlots.add(slotKey, n);
+    }
+
+    // Switch heavy-hitter mode on (counters per summary) or off (0); drops
+    // the summaries.
+    void setApproximate(size_t counters) {
+        approxCounters = counters;
+        heavyZones.setCapacity(counters);
+        heavySlots.setCapacity(counters);
+    }
+
+    // Ranking orders of topZones / topBusySlots, by id.
+    bool zoneBefore(uint32_t a, uint32_t b) const {
+        if (tallies[a].trips != tallies[b].trips) return tallies[a].trips > tallies[b].trips;
+        return zones.name(a) < zones.name(b);
+    }
+    bool slotBefore(uint32_t a, uint32_t b) const {
+        long long ca = tallies[a / 24].hourly[a % 24], cb = tallies[b / 24].hourly[b % 24];
+        if (ca != cb) return ca > cb;
+        if (a / 24 != b / 24) return zones.name(a / 24) < zones.name(b / 24);
+        return a % 24 < b % 24;
+    }
+
+    // Room for n zones in the dictionary without rehashing. The tallies are
+    // left to grow on demand: they are large per zone and cheap to move, so an
+    // overestimate would cost more than the moves it saves.
+    void reserve(size_t n, size_t avgZoneBytes) {
+        zones.reserve(n, avgZoneBytes);
+    }
+
+    // Re-enable the top indexes at a new capacity, re-seeding them from the counts.
+    void setTopCapacity(size_t capacity) {
+        zoneTop.reset(capacity);
+        slotTop.reset(capacity);
+        for (uint32_t id = 0; id < tallies.size(); ++id) {
+            if (tallies[id].trips != 0) touchZone(id);
+            for (int h = 0; h < 24; ++h) {
+                if (tallies[id].hourly[h] != 0) touchSlot(id, h);
+            }
+        }
+    }
+
+    void clear() {
+        zones.clear();
+        tallies.clear();
+        stats = IngestStats{};
+        zoneTop.clear();
+        slotTop.clear();
+        pickupZones = 0;
+        columns.clear();
+        buckets.clear();
+        routes.clear();
+        measures.clear();
+        fareSketches.clear();
+        setApproximate(approxCounters);
+    }
+
+    // Retained rows are appended after this table's own, and bucket, route
+    // and measure totals and fare sketches added, with their zone ids
+    // translated into this dictionary. Routes need finalize() again
+    // afterwards.
+    void merge(const TripTables& other) {
+        bool needRemap = !other.columns.empty() || !other.buckets.empty() || other.routes.size() != 0 ||
+                         !other.measures.empty() || !other.fareSketches.empty();
+        std::vector<uint32_t> remap(needRemap ? other.zones.size() : 0);
+        for (uint32_t id = 0; id < other.zones.size(); ++id) {
+            uint32_t to = intern(other.zones.name(id));
+            if (!remap.empty()) remap[id] = to;
+            // The top indexes are only right if every count is touched as
+            // soon as it grows, before the next one changes, so the zone and
+            // each of its slots go in one at a time.
+            const ZoneTally& from = other.tallies[id];
+            ZoneTally& into = tallies[to];
+            if (from.trips == 0) continue;
+            if (into.trips == 0) ++pickupZones;
+            into.trips += from.trips;
+            touchZone(to);
+            for (int h = 0; h < 24; ++h) {
+                if (from.hourly[h] == 0) continue;
+                into.hourly[h] += from.hourly[h];
+                touchSlot(to, h);
+            }
+        }
+        const TripColumns& c = other.columns;
+        for (size_t i = 0; i < c.size(); ++i) {
+            uint32_t dropoff = c.dropoff[i] == TripColumns::kNoZone ? TripColumns::kNoZone : remap[c.dropoff[i]];
+            columns.push(remap[c.pickup[i]], c.hour[i], dropoff, c.minutes[i], c.distance[i], c.fare[i]);
+        }
+        buckets.merge(other.buckets, remap);
+        routes.merge(other.routes, remap);
+        if (!other.measures.empty()) {
+            if (measures.size() < zones.size()) measures.resize(zones.size());
+            for (uint32_t id = 0; id < other.measures.size(); ++id) measures[remap[id]].add(other.measures[id]);
+        }
+        if (!other.fareSketches.empty()) {
+            if (fareSketches.size() < zones.size()) fareSketches.resize(zones.size());
+            for (uint32_t id = 0; id < other.fareSketches.size(); ++id) {
+                fareSketches[remap[id]].merge(other.fareSketches[id]);
+            }
+        }
+        heavyZones.merge(other.heavyZones);
+        heavySlots.merge(other.heavySlots);
+        stats.add(other.stats);
+    }
+
+private:
+    void touch(uint32_t id, int hour) {
+        touchZone(id);
+        touchSlot(id, hour);
+    }
+
+    void touchZone(uint32_t id) {
+        if (zoneTop.capacity() != 0) {
+            zoneTop.touch(id, [this](uint32_t z) { return tallies[z].trips; },
+                          [this](uint32_t a, uint32_t b) { return zoneBefore(a, b); });
+        }
+    }
+
+    void touchSlot(uint32_t id, int hour) {
+        if (slotTop.capacity() != 0) {
+            slotTop.touch(id * 24 + (uint32_t)hour, [this](uint32_t s) { return tallies[s / 24].hourly[s % 24]; },
+                          [this](uint32_t a, uint32_t b) { return slotBefore(a, b); });
+        }
+    }
+
+    std::string slotKey;   // scratch for countApprox
+};